@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -85,3 +86,37 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Microbenchmark for the coins cache's map at a more realistic size: fill a
+// cache with coins as during IBD, look each of them up, and write them all to
+// a parent cache (which is what flushing the per-block view in ConnectTip
+// amounts to).
+static void CCoinsCacheFillFlush(benchmark::State& state)
+{
+    static const size_t NUM_COINS = 100000;
+    FastRandomContext insecure_rand(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(NUM_COINS);
+    for (size_t i = 0; i < NUM_COINS; ++i) {
+        outpoints.emplace_back(insecure_rand.rand256(), insecure_rand.randbits(2));
+    }
+    const CTxOut txout(50 * CENT, GetScriptForDestination(CKeyID(uint160(insecure_rand.randbytes(20)))));
+
+    while (state.KeepRunning()) {
+        CCoinsView coinsDummy;
+        CCoinsViewCache parent(&coinsDummy);
+        CCoinsViewCache coins(&parent);
+        for (const COutPoint& outpoint : outpoints) {
+            coins.AddCoin(outpoint, Coin(txout, 1, false), false);
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            bool have = coins.HaveCoinInCache(outpoint);
+            assert(have);
+        }
+        bool flushed = coins.Flush();
+        assert(flushed);
+        assert(parent.GetCacheSize() == NUM_COINS);
+    }
+}
+
+BENCHMARK(CCoinsCacheFillFlush, 10);
@@ -6,10 +6,12 @@
 #include <util.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <prevector.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
+#include <uint256.h>
 
 
 static const int MIN_CORES = 2;
@@ -60,3 +62,59 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// This Benchmark measures how the CheckQueue scales with the number of
+// threads (including the master), with checks that take a few microseconds
+// like a signature check, added a few at a time like the inputs of the
+// transactions of a block. Compare the time per run across thread counts.
+static void CCheckQueueScaling(benchmark::State& state, int threads)
+{
+    struct HashJob {
+        uint256 hash;
+        HashJob() {}
+        explicit HashJob(FastRandomContext& insecure_rand) : hash(insecure_rand.rand256()) {}
+        bool operator()()
+        {
+            for (int i = 0; i < 20; i++) {
+                CSHA256().Write(hash.begin(), hash.size()).Finalize(hash.begin());
+            }
+            return true;
+        }
+        void swap(HashJob& x) { std::swap(hash, x.hash); }
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 1; x < threads; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        FastRandomContext insecure_rand(true);
+        CCheckQueueControl<HashJob> control(&queue);
+        std::vector<HashJob> vChecks;
+        for (size_t x = 0; x < 2000; x += 2) {
+            vChecks.emplace_back(insecure_rand);
+            vChecks.emplace_back(insecure_rand);
+            control.Add(vChecks);
+            vChecks.clear();
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling01(benchmark::State& state) { CCheckQueueScaling(state, 1); }
+static void CCheckQueueScaling02(benchmark::State& state) { CCheckQueueScaling(state, 2); }
+static void CCheckQueueScaling04(benchmark::State& state) { CCheckQueueScaling(state, 4); }
+static void CCheckQueueScaling08(benchmark::State& state) { CCheckQueueScaling(state, 8); }
+static void CCheckQueueScaling16(benchmark::State& state) { CCheckQueueScaling(state, 16); }
+static void CCheckQueueScaling32(benchmark::State& state) { CCheckQueueScaling(state, 32); }
+static void CCheckQueueScaling64(benchmark::State& state) { CCheckQueueScaling(state, 64); }
+
+BENCHMARK(CCheckQueueScaling01, 20);
+BENCHMARK(CCheckQueueScaling02, 20);
+BENCHMARK(CCheckQueueScaling04, 20);
+BENCHMARK(CCheckQueueScaling08, 20);
+BENCHMARK(CCheckQueueScaling16, 20);
+BENCHMARK(CCheckQueueScaling32, 20);
+BENCHMARK(CCheckQueueScaling64, 20);
@@ -60,6 +60,40 @@ static void SHA256D64_1024(benchmark::State& state)
     }
 }
 
+static void RIPEMD160_32_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32 * 1024, 0);
+    while (state.KeepRunning()) {
+        RIPEMD160_32(in.data(), in.data(), 1024);
+    }
+}
+
+static void Hash160_33b_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(33 * 1024, 0);
+    uint160 hash;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1024; i++) {
+            hash = Hash160(in.begin() + 33 * i, in.begin() + 33 * (i + 1));
+            in[33 * i] = hash.begin()[0];
+        }
+    }
+}
+
+static void Hash160Batch_33b_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(33 * 1024, 0);
+    std::vector<Span<const unsigned char>> spans;
+    for (int i = 0; i < 1024; i++) {
+        spans.emplace_back(in.data() + 33 * i, 33);
+    }
+    std::vector<uint160> hashes(1024);
+    while (state.KeepRunning()) {
+        Hash160Batch(hashes.data(), spans.data(), spans.size());
+        in[0] = hashes[0].begin()[0];
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -103,5 +137,8 @@ BENCHMARK(SHA512, 330);
 BENCHMARK(SHA256_32b, 4700 * 1000);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(RIPEMD160_32_1024, 7400);
+BENCHMARK(Hash160_33b_1024, 2000);
+BENCHMARK(Hash160Batch_33b_1024, 2000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
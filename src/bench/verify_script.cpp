@@ -7,7 +7,10 @@
 #if defined(HAVE_CONSENSUS_LIB)
 #include <script/bitcoinconsensus.h>
 #endif
+#include <primitives/block.h>
+#include <pubkey.h>
 #include <script/script.h>
+#include <script/sigcache.h>
 #include <script/sign.h>
 #include <script/standard.h>
 #include <streams.h>
@@ -107,3 +110,145 @@ static void VerifyScriptBench(benchmark::State& state)
 }
 
 BENCHMARK(VerifyScriptBench, 6300);
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+/** Counts the signatures checked, as the number of calls to VerifySignature. */
+class CountingSignatureChecker : public TransactionSignatureChecker
+{
+public:
+    mutable int m_count = 0;
+
+    using TransactionSignatureChecker::TransactionSignatureChecker;
+
+protected:
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override
+    {
+        m_count++;
+        return TransactionSignatureChecker::VerifySignature(vchSig, vchPubKey, sighash);
+    }
+};
+
+/** An input of the block with a reconstruction of the output it spends. */
+struct BlockInput {
+    CTransactionRef tx;
+    unsigned int n;
+    CScript scriptPubKey;
+    PrecomputedTransactionData* txdata;
+};
+
+/**
+ * Verify the scripts of the inputs of block 413567, as in ConnectBlock with
+ * an empty signature cache. They all spend P2PKH or P2SH outputs, whose
+ * scriptPubKeys are rebuilt from the scriptSigs. That is 6639 signature
+ * checks per run; divide by the time per run for signatures per second.
+ */
+static void VerifyBlockScripts(benchmark::State& state, bool pubkey_cache)
+{
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    InitSignatureCache();
+
+    CBlock block;
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    stream >> block;
+
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size());
+    std::vector<BlockInput> inputs;
+    int signatures = 0;
+    for (const auto& tx : block.vtx) {
+        txdata.emplace_back(*tx);
+        if (tx->IsCoinBase()) continue;
+        for (unsigned int n = 0; n < tx->vin.size(); n++) {
+            std::vector<std::vector<unsigned char>> pushes;
+            CScript::const_iterator pc = tx->vin[n].scriptSig.begin();
+            opcodetype opcode;
+            std::vector<unsigned char> data;
+            while (tx->vin[n].scriptSig.GetOp(pc, opcode, data) && opcode <= OP_16) {
+                pushes.push_back(data);
+            }
+            if (pc != tx->vin[n].scriptSig.end() || pushes.empty()) continue;
+
+            CScript scriptPubKey;
+            CPubKey pubkey(pushes.back().begin(), pushes.back().end());
+            if (pushes.size() == 2 && pubkey.IsFullyValid()) {
+                scriptPubKey = GetScriptForDestination(pubkey.GetID());
+            } else {
+                scriptPubKey = GetScriptForDestination(CScriptID(CScript(pushes.back().begin(), pushes.back().end())));
+            }
+            CountingSignatureChecker checker(tx.get(), n, 0, txdata.back());
+            if (VerifyScript(tx->vin[n].scriptSig, scriptPubKey, nullptr, flags, checker)) {
+                inputs.push_back(BlockInput{tx, n, scriptPubKey, &txdata.back()});
+                signatures += checker.m_count;
+            }
+        }
+    }
+    assert(inputs.size() == 4886);
+    assert(signatures == 6639);
+
+    while (state.KeepRunning()) {
+        PubKeyParseCache cache;
+        if (pubkey_cache) ParseBlockPubKeys(block, cache);
+        for (const BlockInput& input : inputs) {
+            CachingTransactionSignatureChecker checker(input.tx.get(), input.n, 0, false, *input.txdata, pubkey_cache ? &cache : nullptr);
+            bool success = VerifyScript(input.tx->vin[input.n].scriptSig, input.scriptPubKey, nullptr, flags, checker);
+            assert(success);
+        }
+    }
+}
+
+static void VerifyBlockScriptsBench(benchmark::State& state)
+{
+    VerifyBlockScripts(state, false);
+}
+
+// The same, parsing the public keys used more than once in the block in
+// advance, like ConnectBlock does.
+static void VerifyBlockScriptsPubKeyCacheBench(benchmark::State& state)
+{
+    VerifyBlockScripts(state, true);
+}
+
+BENCHMARK(VerifyBlockScriptsBench, 1);
+BENCHMARK(VerifyBlockScriptsPubKeyCacheBench, 1);
+
+/**
+ * Compute the legacy SIGHASH_ALL signature hashes of all inputs of a
+ * transaction with 2000 P2PKH inputs (about 300 kB with signatures), the worst
+ * case for legacy signature hashing, which covers the whole transaction.
+ */
+static void SignatureHashLegacy(benchmark::State& state, bool precompute)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(2000);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout = COutPoint(uint256S("0x0100000000000000000000000000000000000000000000000000000000000000"), i);
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72) << std::vector<unsigned char>(33);
+    }
+    tx.vout.resize(2);
+    const CScript scriptCode = GetScriptForDestination(CKeyID());
+
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL, 0, SigVersion::BASE, precompute ? &txdata : nullptr);
+        }
+    }
+}
+
+static void SignatureHashLegacyBench(benchmark::State& state)
+{
+    SignatureHashLegacy(state, false);
+}
+
+static void SignatureHashLegacyPrecomputedBench(benchmark::State& state)
+{
+    SignatureHashLegacy(state, true);
+}
+
+BENCHMARK(SignatureHashLegacyBench, 1);
+BENCHMARK(SignatureHashLegacyPrecomputedBench, 2);
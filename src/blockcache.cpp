@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+
+#include <core_memusage.h>
+#include <memusage.h>
+
+std::shared_ptr<const CBlock> BlockCache::Get(const uint256& hash)
+{
+    LOCK(m_cs);
+    auto it = m_index.find(hash);
+    if (it == m_index.end()) {
+        return nullptr;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->block;
+}
+
+void BlockCache::Insert(const uint256& hash, std::shared_ptr<const CBlock> block)
+{
+    // The transactions may be shared with the mempool or other blocks, in which
+    // case this overestimates the memory the cache holds on to.
+    const size_t usage = memusage::MallocUsage(sizeof(Entry) + 2 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(std::pair<const uint256, std::list<Entry>::iterator>) + 4 * sizeof(void*)) +
+        memusage::DynamicUsage(block) + RecursiveDynamicUsage(*block);
+
+    LOCK(m_cs);
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+    // Blocks that would push everything else out are not worth it.
+    if (usage > m_max_usage / 2) {
+        return;
+    }
+    m_entries.push_front(Entry{hash, std::move(block), usage});
+    m_index.emplace(hash, m_entries.begin());
+    m_usage += usage;
+    TrimToSize(m_max_usage);
+}
+
+void BlockCache::TrimToSize(size_t max_usage)
+{
+    while (m_usage > max_usage) {
+        const Entry& entry = m_entries.back();
+        m_usage -= entry.usage;
+        m_index.erase(entry.hash);
+        m_entries.pop_back();
+    }
+}
+
+void BlockCache::Clear()
+{
+    LOCK(m_cs);
+    TrimToSize(0);
+}
+
+void BlockCache::SetMaxUsage(size_t max_usage)
+{
+    LOCK(m_cs);
+    m_max_usage = max_usage;
+    TrimToSize(m_max_usage);
+}
+
+size_t BlockCache::DynamicMemoryUsage() const
+{
+    LOCK(m_cs);
+    return m_usage;
+}
+
+size_t BlockCache::size() const
+{
+    LOCK(m_cs);
+    return m_entries.size();
+}
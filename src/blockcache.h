@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include <primitives/block.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <list>
+#include <map>
+#include <memory>
+
+/**
+ * A memory-bounded cache of deserialized blocks by hash.
+ *
+ * The tip and other recent blocks tend to be read many times in a short while:
+ * by peers, the getblock RPC, REST and the indexes. Keeping them here means
+ * they are read from disk and deserialized only once. When over its size, the
+ * least recently used blocks are dropped.
+ */
+class BlockCache
+{
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> block;
+        size_t usage;
+    };
+
+    mutable CCriticalSection m_cs;
+    size_t m_max_usage GUARDED_BY(m_cs);
+    size_t m_usage GUARDED_BY(m_cs) = 0;
+    //! Cached blocks, most recently used first.
+    std::list<Entry> m_entries GUARDED_BY(m_cs);
+    std::map<uint256, std::list<Entry>::iterator> m_index GUARDED_BY(m_cs);
+
+    void TrimToSize(size_t max_usage) EXCLUSIVE_LOCKS_REQUIRED(m_cs);
+
+public:
+    /** @param[in] max_usage  Memory used for blocks, in bytes; 0 disables the cache. */
+    explicit BlockCache(size_t max_usage) : m_max_usage(max_usage) {}
+
+    /** Get a cached block, or null if it is not in the cache. */
+    std::shared_ptr<const CBlock> Get(const uint256& hash);
+
+    /** Add a block, dropping the least recently used ones if that exceeds the size. */
+    void Insert(const uint256& hash, std::shared_ptr<const CBlock> block);
+
+    /** Drop all blocks. */
+    void Clear();
+
+    /** Change the size of the cache. */
+    void SetMaxUsage(size_t max_usage);
+
+    /** Memory taken up by the cached blocks, as counted against the size. */
+    size_t DynamicMemoryUsage() const;
+    size_t size() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,65 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockmap.h>
+
+#include <memusage.h>
+
+size_t BlockMap::FindSlot(const uint256& hash) const
+{
+    const size_t mask = m_table.size() - 1;
+    for (size_t slot = BlockHasher()(hash) & mask; ; slot = (slot + 1) & mask) {
+        if (m_table[slot] == 0 || At(m_table[slot] - 1).hash == hash) {
+            return slot;
+        }
+    }
+}
+
+void BlockMap::Rehash(size_t size)
+{
+    // Keep the table at most three quarters full.
+    size_t slots = 16;
+    while (slots * 3 < size * 4) {
+        slots *= 2;
+    }
+    if (slots <= m_table.size()) return;
+
+    m_table.assign(slots, 0);
+    for (size_t pos = 0; pos < m_size; pos++) {
+        m_table[FindSlot(At(pos).hash)] = pos + 1;
+    }
+}
+
+BlockMap::Entry& BlockMap::Allocate()
+{
+    if (m_size == m_chunks.size() * CHUNK_SIZE) {
+        m_chunks.emplace_back(new Entry[CHUNK_SIZE]);
+    }
+    return At(m_size);
+}
+
+BlockMap::const_iterator BlockMap::find(const uint256& hash) const
+{
+    if (m_table.empty()) return end();
+    size_t slot = FindSlot(hash);
+    return m_table[slot] == 0 ? end() : const_iterator(this, m_table[slot] - 1);
+}
+
+void BlockMap::reserve(size_t size)
+{
+    Rehash(size);
+}
+
+void BlockMap::clear()
+{
+    m_chunks.clear();
+    m_table.clear();
+    m_table.shrink_to_fit();
+    m_size = 0;
+}
+
+size_t BlockMap::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(sizeof(Entry) * CHUNK_SIZE) * m_chunks.size() + memusage::DynamicUsage(m_chunks) + memusage::DynamicUsage(m_table);
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKMAP_H
+#define BITCOIN_BLOCKMAP_H
+
+#include <chain.h>
+#include <uint256.h>
+
+#include <iterator>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+struct BlockHasher
+{
+    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+};
+
+/**
+ * The block index entries by block hash, which owns the entries.
+ *
+ * The entries are allocated from an arena, together with the hash that their
+ * phashBlock points to, in large chunks that are only freed by clear(). Blocks
+ * tend to be added in chain order, so walks along a chain (like GetAncestor)
+ * touch neighbouring memory. The lookup table is an open addressing hash
+ * table of entry positions, rather than a node per entry. Entries are never
+ * removed individually.
+ *
+ * Iterating visits the entries in the order they were added.
+ */
+class BlockMap
+{
+private:
+    struct Entry {
+        uint256 hash;
+        CBlockIndex index;
+    };
+
+    //! Number of entries allocated at once.
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    std::vector<std::unique_ptr<Entry[]>> m_chunks;
+    size_t m_size = 0;
+    //! Positions of the entries plus one, by hash with linear probing; 0 for empty slots. The size is a power of two.
+    std::vector<uint32_t> m_table;
+
+    Entry& At(size_t pos) const { return m_chunks[pos / CHUNK_SIZE][pos % CHUNK_SIZE]; }
+
+    /** Return the slot of the entry for hash, or the empty slot where it would go. */
+    size_t FindSlot(const uint256& hash) const;
+
+    /** Rebuild the lookup table with at least enough slots for size entries. */
+    void Rehash(size_t size);
+
+    /** Allocate the entry at position m_size, which the caller initializes. */
+    Entry& Allocate();
+
+public:
+    typedef std::pair<const uint256&, CBlockIndex*> value_type;
+
+    class const_iterator
+    {
+    private:
+        const BlockMap* m_map;
+        size_t m_pos;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef BlockMap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type reference;
+
+        /** Makes it->second work, as the values are made on the fly. */
+        struct pointer {
+            value_type value;
+            const value_type* operator->() const { return &value; }
+        };
+
+        const_iterator(const BlockMap* map, size_t pos) : m_map(map), m_pos(pos) {}
+
+        value_type operator*() const
+        {
+            Entry& entry = m_map->At(m_pos);
+            return value_type(entry.hash, &entry.index);
+        }
+        pointer operator->() const { return pointer{**this}; }
+
+        const_iterator& operator++() { ++m_pos; return *this; }
+        const_iterator operator++(int) { const_iterator ret = *this; ++m_pos; return ret; }
+
+        bool operator==(const const_iterator& other) const { return m_pos == other.m_pos; }
+        bool operator!=(const const_iterator& other) const { return m_pos != other.m_pos; }
+    };
+    //! The entries themselves can be modified through either.
+    typedef const_iterator iterator;
+
+    BlockMap() = default;
+    BlockMap(const BlockMap&) = delete;
+    BlockMap& operator=(const BlockMap&) = delete;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const_iterator find(const uint256& hash) const;
+    size_t count(const uint256& hash) const { return find(hash) != end(); }
+
+    /**
+     * Add an entry for hash, constructed from args, unless there is one
+     * already. Returns the entry for hash, and whether it was added.
+     */
+    template <typename... Args>
+    std::pair<const_iterator, bool> emplace(const uint256& hash, Args&&... args)
+    {
+        if ((m_size + 1) * 4 > m_table.size() * 3) {
+            Rehash(m_size + 1);
+        }
+        size_t slot = FindSlot(hash);
+        if (m_table[slot] != 0) {
+            return std::make_pair(const_iterator(this, m_table[slot] - 1), false);
+        }
+        Entry& entry = Allocate();
+        entry.hash = hash;
+        entry.index = CBlockIndex(std::forward<Args>(args)...);
+        entry.index.phashBlock = &entry.hash;
+        m_table[slot] = ++m_size;
+        return std::make_pair(const_iterator(this, m_size - 1), true);
+    }
+
+    /** Make room for size entries in the lookup table. */
+    void reserve(size_t size);
+
+    /** Remove and free all entries. */
+    void clear();
+
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_BLOCKMAP_H
@@ -160,6 +160,10 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    //! Validity (and nTx) assumed from a loaded UTXO set snapshot, rather than established by connecting the block.
+    //! Implies all parents are also ASSUMED_VALID, or actually validated.
+    BLOCK_ASSUMED_VALID      =  256,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -170,7 +174,7 @@ enum BlockStatus: uint32_t {
 class CBlockIndex
 {
 public:
-    //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
+    //! pointer to the hash of the block, if any. Memory is owned by the BlockMap holding this CBlockIndex
     const uint256* phashBlock;
 
     //! pointer to the index of the predecessor of this block
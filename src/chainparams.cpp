@@ -176,6 +176,9 @@ public:
             /* dTxRate  */ 2.4
         };
 
+        // No UTXO set snapshots are accepted on mainnet yet.
+        m_assumeutxo_data = MapAssumeutxo{};
+
         /* disable fallback fee on mainnet */
         m_fallback_fee_enabled = false;
     }
@@ -269,6 +272,9 @@ public:
             /* dTxRate  */ 0.626
         };
 
+        // No UTXO set snapshots are accepted on testnet yet.
+        m_assumeutxo_data = MapAssumeutxo{};
+
         /* enable fallback fee on testnet */
         m_fallback_fee_enabled = true;
     }
@@ -341,6 +347,13 @@ public:
             0
         };
 
+        m_assumeutxo_data = MapAssumeutxo{
+            {
+                110,
+                {uint256S("0x60245070a575b02489b776ed24f6c6a9c5e2960662b561f24486942e6a582120"), 111},
+            },
+        };
+
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,111);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,196);
         base58Prefixes[SECRET_KEY] =     std::vector<unsigned char>(1,239);
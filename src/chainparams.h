@@ -37,6 +37,17 @@ struct ChainTxData {
     double dTxRate;   //!< estimated number of transactions per second after that timestamp
 };
 
+/**
+ * Commitment to the UTXO set at some height, which a UTXO set snapshot must
+ * match to be loaded (see -loadtxoutset).
+ */
+struct AssumeutxoData {
+    uint256 hash_serialized; //!< hash_serialized_2 of the UTXO set, as reported by gettxoutsetinfo
+    unsigned int nChainTx;   //!< number of transactions up to and including the block at that height
+};
+
+typedef std::map<int, AssumeutxoData> MapAssumeutxo;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -80,6 +91,7 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapAssumeutxo& Assumeutxo() const { return m_assumeutxo_data; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 protected:
     CChainParams() {}
@@ -99,6 +111,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo m_assumeutxo_data;
     bool m_fallback_fee_enabled;
 };
 
@@ -8,6 +8,13 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +32,26 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * The verifications are spread over a queue per worker, so that workers do
+  * not contend on one lock for every batch they take. A worker takes batches
+  * from its own queue, and steals from the other queues when it runs out.
+  * The shared mutex is only taken to go to sleep and to wake up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! A queue of verifications, owned by a worker but open to stealing.
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! The queues, the first of which belongs to the master.
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    //! Mutex to sleep and wake up on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,96 +60,150 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Worker threads beyond the limit block on this
+    boost::condition_variable condParked;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of worker threads that have started, excluding the master.
+    std::atomic<unsigned int> nWorkers{0};
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads that may do work; the others sleep.
+    std::atomic<unsigned int> nWorkerLimit{std::numeric_limits<unsigned int>::max()};
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
+
+    //! Number of verifications that are in the queues, not taken by a worker yet.
+    std::atomic<unsigned int> nQueued{0};
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo{0};
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! The queue to add the next verifications to, only used by the master.
+    size_t nNextQueue;
+
+    friend class CCheckQueueControl<T>;
+
+    /** The number of queues in use: those of the master and the working workers. */
+    size_t ActiveQueues() const
+    {
+        return std::min<size_t>(queues.size(), std::min(nWorkers.load(), nWorkerLimit.load()) + 1);
+    }
+
+    /**
+     * Move a batch of verifications from a queue into vChecks: half of them
+     * (at least one, and at most nBatchSize), so that all workers finish
+     * approximately simultaneously. The owner takes them from the back and
+     * others from the front.
+     */
+    bool Take(WorkerQueue& queue, bool fOwner, std::vector<T>& vChecks)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.checks.empty()) return false;
+        unsigned int nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, queue.checks.size() / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap jobs out of the queue instead of copying.
+            if (fOwner) {
+                vChecks[i].swap(queue.checks.back());
+                queue.checks.pop_back();
+            } else {
+                vChecks[i].swap(queue.checks.front());
+                queue.checks.pop_front();
+            }
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        const unsigned int nId = fMaster ? 0 : nWorkers++;
+        const size_t nHome = fMaster ? 0 : 1 + nId % (queues.size() - 1);
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            if (!fMaster && nId >= nWorkerLimit) {
+                // Sleep until we are allowed to work again.
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+                while (nId >= nWorkerLimit) {
+                    condParked.wait(lock);
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                continue;
+            }
+            // Take work from our own queue first, and otherwise from the others.
+            bool fTaken = Take(*queues[nHome], true, vChecks);
+            for (size_t i = 1, nActive = ActiveQueues(); !fTaken && nQueued > 0 && i < nActive; i++) {
+                fTaken = Take(*queues[(nHome + i) % nActive], false, vChecks);
+            }
+            if (!fTaken) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fMaster) {
+                    if (nTodo == 0) {
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    // Wait for the workers to finish their batches.
+                    if (nQueued == 0) condMaster.wait(lock);
+                } else if (nQueued == 0) {
+                    condWorker.wait(lock); // wait
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
+            // Check whether we need to do work at all, and execute it
+            bool fOk = fAllOk;
             for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            // Destroy the checks before reporting them done.
+            unsigned int nNow = vChecks.size();
             vChecks.clear();
+            if (!fOk) fAllOk = false;
+            if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
+    /**
+     * Only let the first n worker threads (by the order in which they
+     * started) do work, and put the others to sleep until it is raised.
+     * This is only done through a CCheckQueueControl before it adds checks,
+     * when the queue is idle: no checks are left behind in the queues of the
+     * workers put to sleep, and no master is waiting for them.
+     */
+    void SetWorkerLimit(unsigned int n)
+    {
+        assert(nTodo == 0);
+        if (nWorkerLimit.exchange(n) < n) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condParked.notify_all();
+        }
+    }
+
 public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : fAllOk(true), nBatchSize(nBatchSizeIn), nNextQueue(0)
+    {
+        // A queue for the master, and one for each worker up to the number
+        // of cores; more workers share the queues.
+        const unsigned int nQueues = 1 + std::max(1U, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < nQueues; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+    }
 
     //! Worker thread
     void Thread()
@@ -145,16 +220,37 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty()) return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        // Spread the checks over the queues in use, in contiguous parts.
+        const size_t nActive = ActiveQueues();
+        const size_t nPart = (vChecks.size() + nActive - 1) / nActive;
+        for (size_t nPos = 0; nPos < vChecks.size(); nPos += nPart) {
+            WorkerQueue& queue = *queues[nNextQueue];
+            nNextQueue = (nNextQueue + 1) % nActive;
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            const size_t nEnd = std::min(nPos + nPart, vChecks.size());
+            for (size_t i = nPos; i < nEnd; i++) {
+                queue.checks.emplace_back();
+                queue.checks.back().swap(vChecks[i]);
+            }
+            // Counted under the lock of the queue, like in Take, so that the
+            // count is never less than the number of checks in the queues.
+            nQueued += nEnd - nPos;
+        }
+        {
+            // Taking the mutex makes sure that a worker that is about to
+            // sleep sees the new checks, or is woken up.
+            boost::unique_lock<boost::mutex> lock(mutex);
+        }
+        // Only wake up as many workers as there are checks to do.
+        if (vChecks.size() >= std::min(nWorkers.load(), nWorkerLimit.load())) {
             condWorker.notify_all();
+        } else {
+            for (size_t i = 0; i < vChecks.size(); i++) {
+                condWorker.notify_one();
+            }
+        }
     }
 
     ~CCheckQueue()
@@ -201,6 +297,13 @@ public:
             pqueue->Add(vChecks);
     }
 
+    /** Limit the number of worker threads; see CCheckQueue::SetWorkerLimit. Call before adding checks. */
+    void SetWorkerLimit(unsigned int n)
+    {
+        if (pqueue != nullptr)
+            pqueue->SetWorkerLimit(n);
+    }
+
     ~CCheckQueueControl()
     {
         if (!fDone)
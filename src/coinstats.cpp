@@ -0,0 +1,158 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <coins.h>
+#include <crypto/muhash.h>
+#include <hash.h>
+#include <serialize.h>
+#include <streams.h>
+#include <util.h>
+#include <validation.h>
+
+#include <map>
+#include <memory>
+
+#include <boost/thread/thread.hpp> // boost::thread::interrupt
+
+uint64_t GetBogoSize(const CScript& script_pub_key)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + script_pub_key.size() /* scriptPubKey */;
+}
+
+static CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Insert(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Remove(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+static void ApplyHash(CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+    }
+    ss << VARINT(0u);
+}
+
+static void ApplyHash(MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    for (const auto& output : outputs) {
+        ApplyCoinHash(muhash, COutPoint(hash, output.first), output.second);
+    }
+}
+
+static void ApplyHash(std::nullptr_t, const uint256& hash, const std::map<uint32_t, Coin>& outputs) {}
+
+template <typename T>
+static void ApplyStats(CCoinsStats& stats, T& hash_obj, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ApplyHash(hash_obj, hash, outputs);
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+}
+
+static void PrepareHash(CHashWriter& ss, const CCoinsStats& stats)
+{
+    ss << stats.hashBlock;
+}
+static void PrepareHash(MuHash3072& muhash, const CCoinsStats& stats) {}
+static void PrepareHash(std::nullptr_t, const CCoinsStats& stats) {}
+
+static void FinalizeHash(CHashWriter& ss, CCoinsStats& stats)
+{
+    stats.hashSerialized = ss.GetHash();
+}
+static void FinalizeHash(MuHash3072& muhash, CCoinsStats& stats)
+{
+    muhash.Finalize(stats.hashSerialized);
+}
+static void FinalizeHash(std::nullptr_t, CCoinsStats& stats) {}
+
+template <typename T>
+static bool GetUTXOStats(CCoinsViewCursor& cursor, CCoinsStats& stats, T hash_obj)
+{
+    stats.hashBlock = cursor.GetBestBlock();
+    PrepareHash(hash_obj, stats);
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (cursor.Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (cursor.GetKey(key) && cursor.GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, hash_obj, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        cursor.Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, hash_obj, prevkey, outputs);
+    }
+    FinalizeHash(hash_obj, stats);
+    return true;
+}
+
+bool GetUTXOStats(CCoinsViewCursor& cursor, CCoinsStats& stats, CoinStatsHashType hash_type)
+{
+    switch (hash_type) {
+    case CoinStatsHashType::HASH_SERIALIZED: {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        return GetUTXOStats(cursor, stats, ss);
+    }
+    case CoinStatsHashType::MUHASH: {
+        MuHash3072 muhash;
+        return GetUTXOStats(cursor, stats, muhash);
+    }
+    case CoinStatsHashType::NONE:
+        return GetUTXOStats(cursor, stats, nullptr);
+    }
+    assert(false);
+}
+
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, CoinStatsHashType hash_type)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    {
+        LOCK(cs_main);
+        stats.nHeight = LookupBlockIndex(pcursor->GetBestBlock())->nHeight;
+    }
+    if (!GetUTXOStats(*pcursor, stats, hash_type)) return false;
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <amount.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+class CCoinsView;
+class CCoinsViewCursor;
+class COutPoint;
+class CScript;
+class Coin;
+class MuHash3072;
+
+enum class CoinStatsHashType {
+    HASH_SERIALIZED,
+    MUHASH,
+    NONE,
+};
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    //! The hash of the set, of the type requested; null for CoinStatsHashType::NONE
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+    //! Whether the statistics came from the coinstats index, which does not
+    //! provide nTransactions and nDiskSize
+    bool index_used;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0), index_used(false) {}
+};
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+/**
+ * Calculate the statistics (except nHeight and nDiskSize) of the coins a
+ * cursor iterates over. Coins must be ordered by outpoint, as they are in the
+ * coins database.
+ */
+bool GetUTXOStats(CCoinsViewCursor& cursor, CCoinsStats& stats, CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+//! Size of a coin in the bogosize metric
+uint64_t GetBogoSize(const CScript& script_pub_key);
+
+//! Add or remove a coin in a MuHash of the UTXO set
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+#endif // BITCOIN_COINSTATS_H
@@ -191,3 +191,19 @@ uint64_t DecompressAmount(uint64_t x)
     }
     return n;
 }
+
+bool IsBlockCompressible(const CBlock& block)
+{
+    if (block.vtx.size() > MAX_COMPRESSED_BLOCK_TXS) return false;
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->vin.size() > MAX_COMPRESSED_TX_INPUTS || tx->vout.size() > MAX_COMPRESSED_TX_OUTPUTS) return false;
+        for (const CTxOut& txout : tx->vout) {
+            // CTxOutCompressor does not round-trip other amounts, and reads
+            // longer scripts back as OP_RETURN.
+            if (!MoneyRange(txout.nValue) || txout.scriptPubKey.size() > MAX_SCRIPT_SIZE) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -6,11 +6,15 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include <consensus/consensus.h>
+#include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
 #include <serialize.h>
 #include <span.h>
 
+#include <map>
+
 class CKeyID;
 class CPubKey;
 class CScriptID;
@@ -22,6 +26,19 @@ bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<uns
 uint64_t CompressAmount(uint64_t nAmount);
 uint64_t DecompressAmount(uint64_t nAmount);
 
+/**
+ * Bounds on the counts in a compressed block, which no block within the size
+ * limits exceeds: a transaction takes at least 10 bytes without its witness,
+ * an input 41 and an output 9. They keep corrupt data from allocating more
+ * than a block's worth of memory.
+ */
+static const uint64_t MAX_COMPRESSED_BLOCK_TXS = MAX_BLOCK_WEIGHT / MIN_SERIALIZABLE_TRANSACTION_WEIGHT;
+static const uint64_t MAX_COMPRESSED_TX_INPUTS = MAX_BLOCK_WEIGHT / (WITNESS_SCALE_FACTOR * 41);
+static const uint64_t MAX_COMPRESSED_TX_OUTPUTS = MAX_BLOCK_WEIGHT / (WITNESS_SCALE_FACTOR * 9);
+
+/** Whether CBlockCompressor can store a block; see there. */
+bool IsBlockCompressible(const CBlock& block);
+
 /** Compact serializer for scripts.
  *
  *  It detects common cases and encodes them much more efficiently.
@@ -108,4 +125,128 @@ public:
     }
 };
 
+/**
+ * Wrapper for CBlock that provides a more compact serialization, to store
+ * blocks in the block files.
+ *
+ * The header is stored as is. Transactions are stored field by field:
+ * * Versions, lock times, output indexes and (inverted) sequence numbers as
+ *   VARINTs, which takes a single byte for the common values.
+ * * Outputs with CTxOutCompressor.
+ * * Prevouts spending an earlier transaction of the same block by the
+ *   position of that transaction instead of its hash.
+ *
+ * This is lossless: the transactions read back serialize the same way, so
+ * they have the same hashes. Only blocks for which IsBlockCompressible holds
+ * can be stored; they must be stored as is otherwise.
+ */
+class CBlockCompressor
+{
+private:
+    //! Version of the format, for future encodings.
+    static const uint8_t FORMAT_VERSION = 0;
+    //! Flag for transactions with witnesses.
+    static const uint8_t TX_FLAG_WITNESS = 1;
+
+    CBlock &block;
+
+    template<typename Stream>
+    static uint64_t ReadCount(Stream& s, uint64_t max_count)
+    {
+        const uint64_t count = ReadCompactSize(s);
+        if (count > max_count) {
+            throw std::ios_base::failure("Compressed block count out of range");
+        }
+        return count;
+    }
+
+public:
+    explicit CBlockCompressor(CBlock &blockIn) : block(blockIn) { }
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << FORMAT_VERSION;
+        s << static_cast<const CBlockHeader&>(block);
+        WriteCompactSize(s, block.vtx.size());
+        // Positions in the block of the transactions written so far.
+        std::map<uint256, uint64_t> positions;
+        for (const CTransactionRef& tx : block.vtx) {
+            WriteVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s, tx->nVersion);
+            s << uint8_t(tx->HasWitness() ? TX_FLAG_WITNESS : 0);
+            WriteCompactSize(s, tx->vin.size());
+            for (const CTxIn& txin : tx->vin) {
+                // 0 for a hash that follows, or the position of the transaction plus one.
+                auto it = positions.find(txin.prevout.hash);
+                if (it != positions.end()) {
+                    WriteVarInt<Stream, VarIntMode::DEFAULT, uint64_t>(s, it->second + 1);
+                } else {
+                    WriteVarInt<Stream, VarIntMode::DEFAULT, uint64_t>(s, 0);
+                    s << txin.prevout.hash;
+                }
+                // The null index of coinbases wraps around to 0.
+                WriteVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s, txin.prevout.n + 1);
+                s << txin.scriptSig;
+                WriteVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s, ~txin.nSequence);
+            }
+            WriteCompactSize(s, tx->vout.size());
+            for (const CTxOut& txout : tx->vout) {
+                ::Serialize(s, CTxOutCompressor(REF(txout)));
+            }
+            if (tx->HasWitness()) {
+                for (const CTxIn& txin : tx->vin) {
+                    s << txin.scriptWitness.stack;
+                }
+            }
+            WriteVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s, tx->nLockTime);
+            positions.emplace(tx->GetHash(), positions.size());
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        uint8_t format_version;
+        s >> format_version;
+        if (format_version != FORMAT_VERSION) {
+            throw std::ios_base::failure("Unknown compressed block format");
+        }
+        block.SetNull();
+        s >> static_cast<CBlockHeader&>(block);
+        block.vtx.resize(ReadCount(s, MAX_COMPRESSED_BLOCK_TXS));
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            CMutableTransaction tx;
+            tx.nVersion = ReadVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s);
+            uint8_t flags;
+            s >> flags;
+            if (flags & ~TX_FLAG_WITNESS) {
+                throw std::ios_base::failure("Unknown compressed transaction flags");
+            }
+            tx.vin.resize(ReadCount(s, MAX_COMPRESSED_TX_INPUTS));
+            for (CTxIn& txin : tx.vin) {
+                uint64_t position = ReadVarInt<Stream, VarIntMode::DEFAULT, uint64_t>(s);
+                if (position == 0) {
+                    s >> txin.prevout.hash;
+                } else if (position <= i) {
+                    txin.prevout.hash = block.vtx[position - 1]->GetHash();
+                } else {
+                    throw std::ios_base::failure("Compressed prevout refers to a later transaction");
+                }
+                txin.prevout.n = ReadVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s) - 1;
+                s >> txin.scriptSig;
+                txin.nSequence = ~ReadVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s);
+            }
+            tx.vout.resize(ReadCount(s, MAX_COMPRESSED_TX_OUTPUTS));
+            for (CTxOut& txout : tx.vout) {
+                ::Unserialize(s, CTxOutCompressor(txout));
+            }
+            if (flags & TX_FLAG_WITNESS) {
+                for (CTxIn& txin : tx.vin) {
+                    s >> txin.scriptWitness.stack;
+                }
+            }
+            tx.nLockTime = ReadVarInt<Stream, VarIntMode::DEFAULT, uint32_t>(s);
+            block.vtx[i] = MakeTransactionRef(std::move(tx));
+        }
+    }
+};
+
 #endif // BITCOIN_COMPRESSOR_H
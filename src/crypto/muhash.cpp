@@ -0,0 +1,276 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include <limits>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the prime modulus. */
+constexpr uint32_t MAX_PRIME_DIFF = 1103717;
+
+typedef uint32_t limb_t;
+typedef uint64_t double_limb_t;
+constexpr int LIMBS = Num3072::LIMBS;
+constexpr int LIMB_SIZE = 32;
+
+/** Whether a (fully reduced modulo 2^3072) is at least the prime. */
+bool IsOverflow(const limb_t* a)
+{
+    if (a[0] <= std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (a[i] != std::numeric_limits<limb_t>::max()) return false;
+    }
+    return true;
+}
+
+/** Add a value below 2^64 - 2^32 to a, modulo 2^3072. Returns the carry out. */
+limb_t AddSmall(limb_t* a, double_limb_t b)
+{
+    double_limb_t c = b;
+    for (int i = 0; i < LIMBS && c; ++i) {
+        c += a[i];
+        a[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    return (limb_t)c;
+}
+
+/** a -= p if a >= p, for a < 2^3072. */
+void FullReduce(limb_t* a)
+{
+    // Subtracting p is adding MAX_PRIME_DIFF modulo 2^3072.
+    if (IsOverflow(a)) AddSmall(a, MAX_PRIME_DIFF);
+}
+
+/** a = a + b mod 2^3072. Returns the carry out. */
+limb_t Add(limb_t* a, const limb_t* b)
+{
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += (double_limb_t)a[i] + b[i];
+        a[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    return (limb_t)c;
+}
+
+/** a = a - b mod 2^3072. Returns the borrow out. */
+limb_t Sub(limb_t* a, const limb_t* b)
+{
+    limb_t borrow = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        const double_limb_t d = (double_limb_t)a[i] - b[i] - borrow;
+        a[i] = (limb_t)d;
+        borrow = (d >> LIMB_SIZE) ? 1 : 0;
+    }
+    return borrow;
+}
+
+bool IsZero(const limb_t* a)
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        if (a[i]) return false;
+    }
+    return true;
+}
+
+bool IsOne(const limb_t* a)
+{
+    if (a[0] != 1) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (a[i]) return false;
+    }
+    return true;
+}
+
+/** a >= b */
+bool GreaterOrEqual(const limb_t* a, const limb_t* b)
+{
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        if (a[i] != b[i]) return a[i] > b[i];
+    }
+    return true;
+}
+
+/** a = (a + top * 2^3072) / 2 */
+void ShiftRight(limb_t* a, limb_t top)
+{
+    for (int i = 0; i < LIMBS - 1; ++i) {
+        a[i] = (a[i] >> 1) | (a[i + 1] << (LIMB_SIZE - 1));
+    }
+    a[LIMBS - 1] = (a[LIMBS - 1] >> 1) | (top << (LIMB_SIZE - 1));
+}
+
+/** a = a / 2 mod p, for a < p. */
+void HalveMod(limb_t* a, const limb_t* p)
+{
+    if (a[0] & 1) {
+        const limb_t carry = Add(a, p);
+        ShiftRight(a, carry);
+    } else {
+        ShiftRight(a, 0);
+    }
+}
+
+/** a = a - b mod p, for a, b < p. */
+void SubMod(limb_t* a, const limb_t* b)
+{
+    if (Sub(a, b)) {
+        // a - b + 2^3072 was computed; a - b + p is MAX_PRIME_DIFF less.
+        limb_t diff[LIMBS] = {MAX_PRIME_DIFF};
+        Sub(a, diff);
+    }
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    FullReduce(limbs);
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a 6144-bit product.
+    limb_t product[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            carry += (double_limb_t)limbs[i] * a.limbs[j] + product[i + j];
+            product[i + j] = (limb_t)carry;
+            carry >>= LIMB_SIZE;
+        }
+        product[i + LIMBS] = (limb_t)carry;
+    }
+
+    // Reduce, using 2^3072 = MAX_PRIME_DIFF (mod p): low + high * MAX_PRIME_DIFF.
+    double_limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        carry += (double_limb_t)product[i + LIMBS] * MAX_PRIME_DIFF + product[i];
+        limbs[i] = (limb_t)carry;
+        carry >>= LIMB_SIZE;
+    }
+    // The remaining carry is below 2^22; fold it in the same way. This can
+    // overflow at most once more, by a carry of one.
+    while (carry) {
+        carry = AddSmall(limbs, carry * MAX_PRIME_DIFF);
+    }
+    FullReduce(limbs);
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Binary extended Euclidean algorithm, maintaining x1 * a = u and x2 * a = v (mod p).
+    limb_t p[LIMBS];
+    for (int i = 0; i < LIMBS; ++i) {
+        p[i] = std::numeric_limits<limb_t>::max();
+    }
+    p[0] -= MAX_PRIME_DIFF - 1;
+
+    assert(!IsZero(limbs));
+    limb_t u[LIMBS], v[LIMBS];
+    memcpy(u, limbs, sizeof(u));
+    memcpy(v, p, sizeof(v));
+    Num3072 x1, x2;
+    memset(x2.limbs, 0, sizeof(x2.limbs));
+
+    while (!IsOne(u) && !IsOne(v)) {
+        while (!(u[0] & 1)) {
+            ShiftRight(u, 0);
+            HalveMod(x1.limbs, p);
+        }
+        while (!(v[0] & 1)) {
+            ShiftRight(v, 0);
+            HalveMod(x2.limbs, p);
+        }
+        if (GreaterOrEqual(u, v)) {
+            Sub(u, v);
+            SubMod(x1.limbs, x2.limbs);
+        } else {
+            Sub(v, u);
+            SubMod(x2.limbs, x1.limbs);
+        }
+    }
+    return IsOne(u) ? x1 : x2;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : m_numerator(ToNum3072(data, len)) {}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    m_numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    m_denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(uint256& out)
+{
+    // Fold the denominator in, so later calls don't need another inverse.
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    m_numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out.begin());
+}
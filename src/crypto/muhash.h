@@ -0,0 +1,95 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, the group MuHash3072 works in. */
+class Num3072
+{
+public:
+    static constexpr size_t BYTE_SIZE = 384;
+    static constexpr int LIMBS = 96;
+
+    //! Little endian 32-bit limbs. Always fully reduced.
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Interpret data as a little endian number, reduced modulo the prime.
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        for (int i = 0; i < LIMBS; ++i) {
+            READWRITE(limbs[i]);
+        }
+    }
+};
+
+/**
+ * A hash of a multiset of byte strings, which can be updated incrementally.
+ *
+ * Each element is expanded to a number modulo a 3072-bit prime by hashing it
+ * with SHA256 and using the result as a ChaCha20 key. The hash of the set is
+ * the SHA256 of the product of those numbers, so elements can be added and
+ * removed in any order, and hashes of disjoint sets combined, in constant
+ * time. Removals are accumulated in a separate denominator, so that the
+ * expensive modular inverse is only needed when finalizing.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set.
+    MuHash3072() {}
+
+    //! The hash of the set containing only the given element.
+    MuHash3072(const unsigned char* data, size_t len);
+
+    //! Add an element.
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+
+    //! Remove an element, which must have been added before (or after) this.
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add all elements of another set.
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    //! Remove all elements of another set.
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the hash of the set to out. This does not change the set.
+    void Finalize(uint256& out);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(m_numerator);
+        READWRITE(m_denominator);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
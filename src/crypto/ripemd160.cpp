@@ -6,7 +6,25 @@
 
 #include <crypto/common.h>
 
+#include <assert.h>
 #include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if defined(USE_ASM)
+#include <cpuid.h>
+#endif
+#endif
+
+namespace ripemd160_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+
+namespace ripemd160_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
 
 // Internal implementation code.
 namespace
@@ -233,10 +251,123 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[4] = t + b1 + c2;
 }
 
+/** Compute the RIPEMD-160 of a 32-byte input, which fits in a single padded chunk. */
+void Transform32(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[5];
+    unsigned char chunk[64] = {0};
+    memcpy(chunk, in, 32);
+    chunk[32] = 0x80;
+    WriteLE64(chunk + 56, 32 << 3);
+    Initialize(s);
+    Transform(s, chunk);
+    WriteLE32(out, s[0]);
+    WriteLE32(out + 4, s[1]);
+    WriteLE32(out + 8, s[2]);
+    WriteLE32(out + 12, s[3]);
+    WriteLE32(out + 16, s[4]);
+}
+
 } // namespace ripemd160
 
+typedef void (*Transform32Type)(unsigned char*, const unsigned char*);
+
+Transform32Type Transform32_4way = nullptr;
+Transform32Type Transform32_8way = nullptr;
+
+bool SelfTest() {
+    // Some random input data to test with
+    static const unsigned char data[258] = "-" // Intentionally not aligned
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+        "eiusmod tempor incididunt ut labore et dolore magna aliqua. Et m"
+        "olestie ac feugiat sed lectus vestibulum mattis ullamcorper. Mor"
+        "bi blandit cursus risus at ultrices mi tempus imperdiet nulla. N";
+    // Expected output of RIPEMD-160 on the 32-byte chunks of data + 1
+    unsigned char expected[160];
+    for (int i = 0; i < 8; ++i) {
+        CRIPEMD160().Write(data + 1 + 32 * i, 32).Finalize(expected + 20 * i);
+    }
+
+    unsigned char out[160];
+
+    // Test Transform32
+    for (int i = 0; i < 8; ++i) {
+        ripemd160::Transform32(out + 20 * i, data + 1 + 32 * i);
+    }
+    if (!std::equal(out, out + 160, expected)) return false;
+
+    // Test Transform32_4way, if available.
+    if (Transform32_4way) {
+        Transform32_4way(out, data + 1);
+        if (!std::equal(out, out + 80, expected)) return false;
+    }
+
+    // Test Transform32_8way, if available.
+    if (Transform32_8way) {
+        Transform32_8way(out, data + 1);
+        if (!std::equal(out, out + 160, expected)) return false;
+    }
+
+    return true;
+}
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(ENABLE_SSE41) || defined(ENABLE_AVX2)) && !defined(BUILD_BITCOIN_INTERNAL)
+#define HAVE_MULTI_WAY_RIPEMD160
+// We can't use cpuid.h's __get_cpuid as it does not support subleafs.
+void inline cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+#ifdef __GNUC__
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+#else
+  __asm__ ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
+#endif
+}
+
+#if defined(ENABLE_AVX2)
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+#endif
 } // namespace
 
+std::string RIPEMD160AutoDetect()
+{
+    std::string ret = "standard";
+#if defined(HAVE_MULTI_WAY_RIPEMD160)
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    const bool have_sse4 = (ecx >> 19) & 1;
+
+#if defined(ENABLE_SSE41)
+    if (have_sse4) {
+        Transform32_4way = ripemd160_sse41::Transform_4way;
+        ret += ",sse41(4way)";
+    }
+#endif
+
+#if defined(ENABLE_AVX2)
+    const bool have_xsave = (ecx >> 27) & 1;
+    const bool have_avx = (ecx >> 28) & 1;
+    if (have_sse4 && have_xsave && have_avx && AVXEnabled()) {
+        cpuid(7, 0, eax, ebx, ecx, edx);
+        if ((ebx >> 5) & 1) {
+            Transform32_8way = ripemd160_avx2::Transform_8way;
+            ret += ",avx2(8way)";
+        }
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
 ////// RIPEMD160
 
 CRIPEMD160::CRIPEMD160() : bytes(0)
@@ -290,3 +421,29 @@ CRIPEMD160& CRIPEMD160::Reset()
     ripemd160::Initialize(s);
     return *this;
 }
+
+void RIPEMD160_32(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (Transform32_8way) {
+        while (blocks >= 8) {
+            Transform32_8way(out, in);
+            out += 160;
+            in += 256;
+            blocks -= 8;
+        }
+    }
+    if (Transform32_4way) {
+        while (blocks >= 4) {
+            Transform32_4way(out, in);
+            out += 80;
+            in += 128;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        ripemd160::Transform32(out, in);
+        out += 20;
+        in += 32;
+        --blocks;
+    }
+}
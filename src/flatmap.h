@@ -0,0 +1,395 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with a flat open addressing index and pooled entry storage.
+ *
+ * std::unordered_map allocates one heap node per entry and chains them from
+ * an array of bucket pointers, so every entry pays for the allocator's
+ * bookkeeping and every lookup chases at least two pointers. This map instead
+ * keeps:
+ *  - entries in a small number of large chunks, handed out from a free list.
+ *    Chunks start small and grow up to a fixed size, so that short-lived maps
+ *    stay cheap while large ones waste at most one partially used chunk.
+ *  - a power-of-two array of 8-byte slots, probed linearly, holding the index
+ *    of an entry and 32 bits of its hash. Most mismatches are rejected without
+ *    touching the entry, and growing the index never requires rehashing keys.
+ *
+ * Entries never move once inserted: references, pointers and iterators to an
+ * entry stay valid until that entry is erased or the map is cleared, even
+ * across insertions. Iteration order is unspecified.
+ *
+ * The interface is the subset of std::unordered_map's used by the coins cache.
+ */
+template <typename K, typename T, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+private:
+    enum : uint32_t {
+        NO_NODE = 0xffffffff,   //!< Empty slot, end of the free list, or end iterator
+        DELETED = 0xfffffffe,   //!< Slot of an erased entry (tombstone)
+        NODE_USED = 0xfffffffd, //!< Free list link of a node holding an entry
+    };
+
+    /** Chunks hold 2^MIN_CHUNK_BITS nodes at first, doubling up to 2^MAX_CHUNK_BITS. */
+    static const int MIN_CHUNK_BITS = 4;
+    static const int MAX_CHUNK_BITS = 12;
+    static const int GROWING_CHUNKS = MAX_CHUNK_BITS - MIN_CHUNK_BITS;
+    /** Number of nodes in all chunks smaller than the maximum size. */
+    static const uint32_t GROWING_NODES = (1U << MAX_CHUNK_BITS) - (1U << MIN_CHUNK_BITS);
+
+    struct Node
+    {
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type data;
+        //! Hash tag of the entry, to find its slot again without rehashing the key
+        uint32_t tag;
+        //! NODE_USED if this node holds an entry, otherwise the next free node
+        uint32_t next_free;
+
+        value_type& value() { return *reinterpret_cast<value_type*>(&data); }
+        const value_type& value() const { return *reinterpret_cast<const value_type*>(&data); }
+    };
+
+    struct Slot
+    {
+        uint32_t node;
+        uint32_t tag;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<std::unique_ptr<Node[]>> m_chunks;
+    //! Number of nodes ever handed out (below this index, nodes are either used or on the free list)
+    uint32_t m_node_count = 0;
+    uint32_t m_node_capacity = 0;
+    uint32_t m_free = NO_NODE;
+    uint32_t m_size = 0;
+    uint32_t m_deleted = 0;
+    Hash m_hash;
+    KeyEqual m_equal;
+
+    static void LocateNode(uint32_t index, size_t& chunk, size_t& offset)
+    {
+        if (index < GROWING_NODES) {
+            // Chunk k starts at (2^k - 1) << MIN_CHUNK_BITS.
+            uint32_t v = (index >> MIN_CHUNK_BITS) + 1;
+            chunk = 0;
+            while (v >>= 1) ++chunk;
+            offset = index - (((uint32_t{1} << chunk) - 1) << MIN_CHUNK_BITS);
+        } else {
+            chunk = GROWING_CHUNKS + ((index - GROWING_NODES) >> MAX_CHUNK_BITS);
+            offset = (index - GROWING_NODES) & ((1U << MAX_CHUNK_BITS) - 1);
+        }
+    }
+
+    Node& GetNode(uint32_t index) const
+    {
+        size_t chunk, offset;
+        LocateNode(index, chunk, offset);
+        return m_chunks[chunk][offset];
+    }
+
+    uint32_t Tag(const K& key) const
+    {
+        const uint64_t hash = m_hash(key);
+        return (uint32_t)hash ^ (uint32_t)(hash >> 32);
+    }
+
+    uint32_t AllocateNode()
+    {
+        if (m_free != NO_NODE) {
+            uint32_t index = m_free;
+            m_free = GetNode(index).next_free;
+            return index;
+        }
+        if (m_node_count == m_node_capacity) {
+            size_t chunk_nodes = chunk_size(m_chunks.size());
+            assert(m_node_capacity + chunk_nodes < NODE_USED);
+            m_chunks.emplace_back(new Node[chunk_nodes]);
+            m_node_capacity += chunk_nodes;
+        }
+        return m_node_count++;
+    }
+
+    void ReleaseNode(uint32_t index)
+    {
+        GetNode(index).next_free = m_free;
+        m_free = index;
+    }
+
+    /** Return the first node holding an entry at or after index, or NO_NODE. */
+    uint32_t NextUsed(uint32_t index) const
+    {
+        while (index < m_node_count) {
+            if (GetNode(index).next_free == NODE_USED) return index;
+            ++index;
+        }
+        return NO_NODE;
+    }
+
+    uint32_t FindNode(const K& key, uint32_t tag) const
+    {
+        if (m_slots.empty()) return NO_NODE;
+        const size_t mask = m_slots.size() - 1;
+        for (size_t pos = tag & mask; ; pos = (pos + 1) & mask) {
+            const Slot& slot = m_slots[pos];
+            if (slot.node == NO_NODE) return NO_NODE;
+            if (slot.node != DELETED && slot.tag == tag && m_equal(GetNode(slot.node).value().first, key)) return slot.node;
+        }
+    }
+
+    void InsertSlot(uint32_t index, uint32_t tag)
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t pos = tag & mask;
+        while (m_slots[pos].node != NO_NODE && m_slots[pos].node != DELETED) {
+            pos = (pos + 1) & mask;
+        }
+        if (m_slots[pos].node == DELETED) --m_deleted;
+        m_slots[pos].node = index;
+        m_slots[pos].tag = tag;
+    }
+
+    /** Make room in the index for one more entry, keeping it at most 7/8 full (tombstones included). */
+    void ReserveSlot()
+    {
+        size_t capacity = m_slots.size();
+        if ((m_size + m_deleted + 1) * size_t{8} <= capacity * 7) return;
+        if (capacity == 0) {
+            capacity = 16;
+        } else if ((m_size + 1) * size_t{16} > capacity * 7) {
+            // Only grow if live entries make up most of the load; otherwise
+            // rebuilding the index at the same size suffices to drop tombstones.
+            capacity *= 2;
+        }
+        std::vector<Slot> old_slots(capacity, Slot{NO_NODE, 0});
+        old_slots.swap(m_slots);
+        m_deleted = 0;
+        for (const Slot& slot : old_slots) {
+            if (slot.node != NO_NODE && slot.node != DELETED) InsertSlot(slot.node, slot.tag);
+        }
+    }
+
+    template <bool Const>
+    class iterator_base
+    {
+    private:
+        typedef typename std::conditional<Const, const flatmap, flatmap>::type map_type;
+        map_type* m_map;
+        uint32_t m_index;
+
+        friend class flatmap;
+        template <bool> friend class iterator_base;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flatmap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+        iterator_base() : m_map(nullptr), m_index(NO_NODE) {}
+        iterator_base(map_type* map, uint32_t index) : m_map(map), m_index(index) {}
+        /** Allow conversion from iterator to const_iterator. */
+        template <bool C = Const, typename = typename std::enable_if<C>::type>
+        iterator_base(const iterator_base<false>& other) : m_map(other.m_map), m_index(other.m_index) {}
+
+        reference operator*() const { return m_map->GetNode(m_index).value(); }
+        pointer operator->() const { return &m_map->GetNode(m_index).value(); }
+        iterator_base& operator++() { m_index = m_map->NextUsed(m_index + 1); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        template <bool C>
+        bool operator==(const iterator_base<C>& other) const { return m_index == other.m_index; }
+        template <bool C>
+        bool operator!=(const iterator_base<C>& other) const { return m_index != other.m_index; }
+    };
+
+public:
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+
+    flatmap() {}
+    flatmap(const flatmap&) = delete;
+    flatmap& operator=(const flatmap&) = delete;
+    ~flatmap() { clear(); }
+
+    iterator begin() { return iterator(this, NextUsed(0)); }
+    const_iterator begin() const { return const_iterator(this, NextUsed(0)); }
+    iterator end() { return iterator(this, NO_NODE); }
+    const_iterator end() const { return const_iterator(this, NO_NODE); }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    iterator find(const K& key) { return iterator(this, FindNode(key, Tag(key))); }
+    const_iterator find(const K& key) const { return const_iterator(this, FindNode(key, Tag(key))); }
+    size_type count(const K& key) const { return FindNode(key, Tag(key)) == NO_NODE ? 0 : 1; }
+
+    /**
+     * Construct an entry from args, and insert it unless an entry with the
+     * same key exists. Like std::unordered_map::emplace, the entry is
+     * constructed (and args consumed) in either case.
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        const uint32_t index = AllocateNode();
+        Node& node = GetNode(index);
+        try {
+            ::new (&node.data) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            ReleaseNode(index);
+            throw;
+        }
+        const uint32_t tag = Tag(node.value().first);
+        const uint32_t existing = FindNode(node.value().first, tag);
+        if (existing != NO_NODE) {
+            node.value().~value_type();
+            ReleaseNode(index);
+            return std::make_pair(iterator(this, existing), false);
+        }
+        ReserveSlot();
+        InsertSlot(index, tag);
+        node.tag = tag;
+        node.next_free = NODE_USED;
+        ++m_size;
+        return std::make_pair(iterator(this, index), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it == end()) {
+            it = emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first;
+        }
+        return it->second;
+    }
+
+    /** Erase the entry it points to, and return an iterator to the entry following it. */
+    iterator erase(const_iterator it)
+    {
+        const uint32_t index = it.m_index;
+        Node& node = GetNode(index);
+        assert(node.next_free == NODE_USED);
+        const size_t mask = m_slots.size() - 1;
+        size_t pos = node.tag & mask;
+        while (m_slots[pos].node != index) {
+            pos = (pos + 1) & mask;
+        }
+        // A slot followed by an empty one terminates no probe sequence, so it can be emptied as well.
+        if (m_slots[(pos + 1) & mask].node == NO_NODE) {
+            m_slots[pos].node = NO_NODE;
+        } else {
+            m_slots[pos].node = DELETED;
+            ++m_deleted;
+        }
+        node.value().~value_type();
+        ReleaseNode(index);
+        --m_size;
+        return iterator(this, NextUsed(index + 1));
+    }
+
+    /** Remove all entries, and release all memory. */
+    void clear()
+    {
+        for (uint32_t index = 0; index < m_node_count; ++index) {
+            Node& node = GetNode(index);
+            if (node.next_free == NODE_USED) node.value().~value_type();
+        }
+        std::vector<Slot>().swap(m_slots);
+        std::vector<std::unique_ptr<Node[]>>().swap(m_chunks);
+        m_node_count = 0;
+        m_node_capacity = 0;
+        m_free = NO_NODE;
+        m_size = 0;
+        m_deleted = 0;
+    }
+
+    /** Pack the entries into the lowest nodes, and release unused chunks and
+     *  index space. Unlike other operations, this moves entries: it
+     *  invalidates all references and iterators. */
+    void shrink_to_fit()
+    {
+        if (m_size == 0) {
+            clear();
+            return;
+        }
+        // Move entries from the highest used nodes into the lowest free ones.
+        uint32_t low = 0;
+        uint32_t high = m_node_count;
+        while (true) {
+            while (low < m_size && GetNode(low).next_free == NODE_USED) ++low;
+            if (low == m_size) break;
+            do --high; while (GetNode(high).next_free != NODE_USED);
+            Node& from = GetNode(high);
+            Node& to = GetNode(low);
+            ::new (&to.data) value_type(std::move(from.value()));
+            from.value().~value_type();
+            to.tag = from.tag;
+            to.next_free = NODE_USED;
+        }
+        m_node_count = m_size;
+        m_free = NO_NODE;
+        while (m_node_capacity - chunk_size(m_chunks.size() - 1) >= m_node_count) {
+            m_node_capacity -= chunk_size(m_chunks.size() - 1);
+            m_chunks.pop_back();
+        }
+        m_chunks.shrink_to_fit();
+        // Rebuild the index at the smallest size that does not need to grow on the next insertion.
+        size_t capacity = 16;
+        while (m_size * size_t{16} > capacity * 7) capacity *= 2;
+        std::vector<Slot>(capacity, Slot{NO_NODE, 0}).swap(m_slots);
+        m_deleted = 0;
+        for (uint32_t index = 0; index < m_node_count; ++index) {
+            InsertSlot(index, GetNode(index).tag);
+        }
+    }
+
+    /** Exchange the contents (and hasher) of two maps. Entries keep their
+     *  addresses, but iterators are invalidated. */
+    void swap(flatmap& other)
+    {
+        using std::swap;
+        swap(m_slots, other.m_slots);
+        swap(m_chunks, other.m_chunks);
+        swap(m_node_count, other.m_node_count);
+        swap(m_node_capacity, other.m_node_capacity);
+        swap(m_free, other.m_free);
+        swap(m_size, other.m_size);
+        swap(m_deleted, other.m_deleted);
+        swap(m_hash, other.m_hash);
+        swap(m_equal, other.m_equal);
+    }
+
+    /** Number of slots in the index. */
+    size_type bucket_count() const { return m_slots.size(); }
+    /** Number of node chunks allocated. */
+    size_type chunk_count() const { return m_chunks.size(); }
+    /** Number of nodes in chunk k. */
+    static size_t chunk_size(size_t k) { return size_t{1} << (k < GROWING_CHUNKS ? MIN_CHUNK_BITS + k : MAX_CHUNK_BITS); }
+
+    static const size_t SLOT_SIZE = sizeof(Slot);
+    static const size_t NODE_SIZE = sizeof(Node);
+};
+
+#endif // BITCOIN_FLATMAP_H
@@ -6,6 +6,8 @@
 #include <crypto/common.h>
 #include <crypto/hmac_sha512.h>
 
+#include <algorithm>
+#include <string.h>
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -68,6 +70,27 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
     return h1;
 }
 
+void Hash160Batch(uint160* output, const Span<const unsigned char>* inputs, size_t count)
+{
+    // Only the RIPEMD160 of the SHA256 outputs is done in parallel.
+    static const size_t BATCH_SIZE = 64;
+    unsigned char sha[BATCH_SIZE * CSHA256::OUTPUT_SIZE];
+    unsigned char ripemd[BATCH_SIZE * CRIPEMD160::OUTPUT_SIZE];
+    while (count) {
+        const size_t n = std::min(count, BATCH_SIZE);
+        for (size_t i = 0; i < n; i++) {
+            CSHA256().Write(inputs[i].data(), inputs[i].size()).Finalize(sha + i * CSHA256::OUTPUT_SIZE);
+        }
+        RIPEMD160_32(ripemd, sha, n);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(output[i].begin(), ripemd + i * CRIPEMD160::OUTPUT_SIZE, CRIPEMD160::OUTPUT_SIZE);
+        }
+        output += n;
+        inputs += n;
+        count -= n;
+    }
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
 {
     unsigned char num[4];
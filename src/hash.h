@@ -10,6 +10,7 @@
 #include <crypto/sha256.h>
 #include <prevector.h>
 #include <serialize.h>
+#include <span.h>
 #include <uint256.h>
 #include <version.h>
 
@@ -112,6 +113,10 @@ inline uint160 Hash160(const prevector<N, unsigned char>& vch)
     return Hash160(vch.begin(), vch.end());
 }
 
+/** Compute the 160-bit hashes of count objects at once. This is faster than
+ *  hashing them one by one when a multi-lane RIPEMD160 is available. */
+void Hash160Batch(uint160* output, const Span<const unsigned char>* inputs, size_t count);
+
 /** A writer stream (for serialization) that computes a 256-bit hash. */
 class CHashWriter
 {
@@ -0,0 +1,229 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <crypto/sha256.h>
+#include <index/addressindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+#include <map>
+
+constexpr char DB_ADDRESS = 'a';
+constexpr char DB_BLOCK_HEIGHT = 'h';
+
+std::unique_ptr<AddressIndex> g_address_index;
+
+namespace {
+
+struct DBAddressKey
+{
+    uint256 script_hash;
+    AddressHistoryPos pos;
+
+    DBAddressKey() {}
+    DBAddressKey(const uint256& script_hash_in, const AddressHistoryPos& pos_in) :
+        script_hash(script_hash_in), pos(pos_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_ADDRESS);
+        s << script_hash << pos;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        if (ser_readdata8(s) != DB_ADDRESS) {
+            throw std::ios_base::failure("Invalid format for address index DB key");
+        }
+        s >> script_hash >> pos;
+    }
+};
+
+struct DBAddressValue
+{
+    uint256 txid;
+    CAmount amount;
+
+    DBAddressValue() : amount(0) {}
+    DBAddressValue(const uint256& txid_in, CAmount amount_in) : txid(txid_in), amount(amount_in) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(txid);
+        READWRITE(amount);
+    }
+};
+
+struct DBHeightKey
+{
+    int height;
+
+    explicit DBHeightKey(int height_in) : height(height_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_BLOCK_HEIGHT);
+        ser_writedata32be(s, height);
+    }
+};
+
+} // namespace
+
+/**
+ * Access to the address index database (indexes/addressindex/)
+ *
+ * Besides the entries of every script, the database records the hash of the
+ * block it indexed at each height. Entries at a height are only returned if
+ * that block is in the active chain. When a block at a height is replaced after
+ * a reorg, the entries of the old block are erased.
+ */
+class AddressIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+AddressIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "addressindex", n_cache_size, f_memory, f_wipe)
+{}
+
+AddressIndex::AddressIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<AddressIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+AddressIndex::~AddressIndex() {}
+
+uint256 AddressIndex::GetScriptHash(const CScript& script)
+{
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+void AddressIndex::WriteEntries(CDBBatch& batch, const CBlock& block, const CBlockUndo& block_undo,
+                                int height, bool erase) const
+{
+    auto write = [&](const CScript& script, const AddressHistoryPos& pos, const uint256& txid, CAmount amount) {
+        DBAddressKey key(GetScriptHash(script), pos);
+        if (erase) {
+            batch.Erase(key);
+        } else {
+            batch.Write(key, DBAddressValue(txid, amount));
+        }
+    };
+
+    AddressHistoryPos pos;
+    pos.height = height;
+    for (uint32_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        pos.tx_pos = i;
+
+        pos.spend = false;
+        for (uint32_t j = 0; j < tx.vout.size(); ++j) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable()) continue;
+            pos.io_index = j;
+            write(out.scriptPubKey, pos, tx.GetHash(), out.nValue);
+        }
+
+        if (tx.IsCoinBase()) continue;
+        const CTxUndo& tx_undo = block_undo.vtxundo.at(i - 1);
+        pos.spend = true;
+        for (uint32_t j = 0; j < tx_undo.vprevout.size(); ++j) {
+            const CTxOut& prevout = tx_undo.vprevout[j].out;
+            pos.io_index = j;
+            write(prevout.scriptPubKey, pos, tx.GetHash(), prevout.nValue);
+        }
+    }
+}
+
+bool AddressIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CDBBatch batch(*m_db);
+
+    // Erase the entries of a block that was indexed at this height before a reorg.
+    uint256 old_block_hash;
+    if (m_db->Read(DBHeightKey(pindex->nHeight), old_block_hash) && old_block_hash != pindex->GetBlockHash()) {
+        const CBlockIndex* old_pindex;
+        {
+            LOCK(cs_main);
+            old_pindex = LookupBlockIndex(old_block_hash);
+        }
+        CBlock old_block;
+        CBlockUndo old_block_undo;
+        if (!old_pindex || !ReadBlockFromDisk(old_block, old_pindex, Params().GetConsensus()) ||
+            (old_pindex->nHeight > 0 && !UndoReadFromDisk(old_block_undo, old_pindex))) {
+            return error("%s: Failed to read block %s to erase its entries", __func__, old_block_hash.ToString());
+        }
+        WriteEntries(batch, old_block, old_block_undo, pindex->nHeight, true);
+    }
+
+    CBlockUndo block_undo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: Failed to read undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    WriteEntries(batch, block, block_undo, pindex->nHeight, false);
+    batch.Write(DBHeightKey(pindex->nHeight), pindex->GetBlockHash());
+    return m_db->WriteBatch(batch);
+}
+
+BaseIndex::DB& AddressIndex::GetDB() const { return *m_db; }
+
+bool AddressIndex::LookupHistory(const uint256& script_hash, const AddressHistoryPos& start, size_t max_count,
+                                 std::vector<AddressHistoryEntry>& entries, bool& more, AddressHistoryPos& next) const
+{
+    // The hash of the block in the active chain at each height seen, or null
+    // if the index has another block there.
+    std::map<int, uint256> active_blocks;
+    auto get_active_block = [&](int height) -> const uint256& {
+        auto it = active_blocks.find(height);
+        if (it != active_blocks.end()) return it->second;
+
+        uint256& block_hash = active_blocks[height];
+        if (m_db->Read(DBHeightKey(height), block_hash)) {
+            LOCK(cs_main);
+            if (!chainActive[height] || chainActive[height]->GetBlockHash() != block_hash) {
+                block_hash.SetNull();
+            }
+        }
+        return block_hash;
+    };
+
+    entries.clear();
+    more = false;
+    std::unique_ptr<CDBIterator> it(m_db->NewIterator());
+    DBAddressKey key;
+    for (it->Seek(DBAddressKey(script_hash, start)); it->Valid(); it->Next()) {
+        if (!it->GetKey(key) || key.script_hash != script_hash) break;
+
+        const uint256& block_hash = get_active_block(key.pos.height);
+        if (block_hash.IsNull()) continue;
+
+        if (entries.size() == max_count) {
+            more = true;
+            next = key.pos;
+            break;
+        }
+
+        DBAddressValue value;
+        if (!it->GetValue(value)) {
+            return error("%s: Cannot read entry of script %s", __func__, script_hash.ToString());
+        }
+        AddressHistoryEntry entry;
+        entry.pos = key.pos;
+        entry.block_hash = block_hash;
+        entry.txid = value.txid;
+        entry.amount = value.amount;
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
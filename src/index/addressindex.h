@@ -0,0 +1,109 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <index/base.h>
+#include <script/script.h>
+
+class CBlockUndo;
+
+/** Position of an entry in the history of a script, in block order. */
+struct AddressHistoryPos
+{
+    int height{0};
+    //! Position of the transaction in its block.
+    uint32_t tx_pos{0};
+    //! Whether the entry is an input spending the script, rather than an output paying to it.
+    bool spend{false};
+    //! Index of the output or input in the transaction.
+    uint32_t io_index{0};
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata32be(s, height);
+        ser_writedata32be(s, tx_pos);
+        ser_writedata8(s, spend);
+        ser_writedata32be(s, io_index);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        height = ser_readdata32be(s);
+        tx_pos = ser_readdata32be(s);
+        spend = ser_readdata8(s);
+        io_index = ser_readdata32be(s);
+    }
+};
+
+/** An output paying to a script, or an input spending one. */
+struct AddressHistoryEntry
+{
+    AddressHistoryPos pos;
+    uint256 block_hash;
+    uint256 txid;
+    //! Value of the output created or spent.
+    CAmount amount{0};
+};
+
+/**
+ * AddressIndex records, for every script, the outputs paying to it and the
+ * inputs spending them, so that the history of an address can be read
+ * without scanning blocks or the UTXO set. Entries are keyed by the SHA256
+ * of the scriptPubKey followed by their position in the chain, and are read
+ * back a page at a time in block order.
+ */
+class AddressIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /// Add (or erase) the entries of a block to the batch.
+    void WriteEntries(CDBBatch& batch, const CBlock& block, const CBlockUndo& block_undo,
+                      int height, bool erase) const;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool AllowParallelWrites() const override { return true; }
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "addressindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit AddressIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~AddressIndex() override;
+
+    /// Hash of a script as used for index keys.
+    static uint256 GetScriptHash(const CScript& script);
+
+    /// Look up a page of the history of a script in the active chain.
+    ///
+    /// @param[in]   script_hash  The script, as returned by GetScriptHash.
+    /// @param[in]   start  Position to start at; entries before it are skipped.
+    /// @param[in]   max_count  Maximum number of entries to return.
+    /// @param[out]  entries  The entries found, in block order.
+    /// @param[out]  more  Whether there are more entries after the returned ones.
+    /// @param[out]  next  If there are more entries, the position of the next one.
+    /// @return  true on success, false if the index could not be read.
+    bool LookupHistory(const uint256& script_hash, const AddressHistoryPos& start, size_t max_count,
+                       std::vector<AddressHistoryEntry>& entries, bool& more, AddressHistoryPos& next) const;
+};
+
+/// The global address index. May be null.
+extern std::unique_ptr<AddressIndex> g_address_index;
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
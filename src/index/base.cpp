@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chainparams.h>
+#include <checkqueue.h>
 #include <index/base.h>
 #include <shutdown.h>
 #include <tinyformat.h>
@@ -15,6 +16,9 @@ constexpr char DB_BEST_BLOCK = 'B';
 
 constexpr int64_t SYNC_LOG_INTERVAL = 30; // seconds
 constexpr int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30; // seconds
+//! Number of blocks handed to the sync workers at once. Unless the index allows
+//! parallel writes, the blocks of a batch are all kept in memory until written.
+constexpr size_t SYNC_BATCH_SIZE = 64;
 
 template<typename... Args>
 static void FatalError(const char* fmt, const Args&... args)
@@ -28,6 +32,58 @@ static void FatalError(const char* fmt, const Args&... args)
     StartShutdown();
 }
 
+/**
+ * Closure representing the sync of one block by an index: reading it from disk
+ * and either writing it to the index or, if the block is handed back to the
+ * sync thread to be written, preparing it.
+ */
+class CIndexSyncCheck
+{
+private:
+    BaseIndex* m_index;
+    const CBlockIndex* m_pindex;
+    //! Where to store the block for the sync thread, or null to write it here.
+    CBlock* m_block;
+
+public:
+    CIndexSyncCheck() : m_index(nullptr), m_pindex(nullptr), m_block(nullptr) {}
+    CIndexSyncCheck(BaseIndex& index, const CBlockIndex* pindex, CBlock* block) :
+        m_index(&index), m_pindex(pindex), m_block(block) {}
+
+    bool operator()()
+    {
+        CBlock block;
+        CBlock& result = m_block ? *m_block : block;
+        if (!ReadBlockFromDisk(result, m_pindex, Params().GetConsensus())) {
+            return error("%s: Failed to read block %s from disk", __func__, m_pindex->GetBlockHash().ToString());
+        }
+        if (m_block && !m_index->PrepareBlock(result, m_pindex)) {
+            return error("%s: Failed to prepare block %s for %s", __func__, m_pindex->GetBlockHash().ToString(),
+                         m_index->GetName());
+        }
+        if (!m_block && !m_index->WriteBlock(result, m_pindex)) {
+            return error("%s: Failed to write block %s to %s", __func__, m_pindex->GetBlockHash().ToString(),
+                         m_index->GetName());
+        }
+        return true;
+    }
+
+    void swap(CIndexSyncCheck& check)
+    {
+        std::swap(m_index, check.m_index);
+        std::swap(m_pindex, check.m_pindex);
+        std::swap(m_block, check.m_block);
+    }
+};
+
+// Every check reads a whole block, so hand them out to the workers one at a time.
+static CCheckQueue<CIndexSyncCheck> indexsyncqueue(1);
+
+void ThreadIndexSync() {
+    RenameThread("bitcoin-idxsync");
+    indexsyncqueue.Thread();
+}
+
 BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate) :
     CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate)
 {}
@@ -41,9 +97,9 @@ bool BaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
     return success;
 }
 
-bool BaseIndex::DB::WriteBestBlock(const CBlockLocator& locator)
+void BaseIndex::DB::WriteBestBlock(CDBBatch& batch, const CBlockLocator& locator)
 {
-    return Write(DB_BEST_BLOCK, locator);
+    batch.Write(DB_BEST_BLOCK, locator);
 }
 
 BaseIndex::~BaseIndex()
@@ -60,7 +116,12 @@ bool BaseIndex::Init()
     }
 
     LOCK(cs_main);
-    m_best_block_index = FindForkInGlobalIndex(chainActive, locator);
+    if (locator.IsNull()) {
+        // Start from before the genesis block, so that it is indexed too.
+        m_best_block_index = nullptr;
+    } else {
+        m_best_block_index = FindForkInGlobalIndex(chainActive, locator);
+    }
     m_synced = m_best_block_index.load() == chainActive.Tip();
     return true;
 }
@@ -85,13 +146,15 @@ void BaseIndex::ThreadSync()
 {
     const CBlockIndex* pindex = m_best_block_index.load();
     if (!m_synced) {
-        auto& consensus_params = Params().GetConsensus();
+        const bool parallel_writes = AllowParallelWrites();
+        std::vector<const CBlockIndex*> batch;
+        std::vector<CBlock> blocks;
 
         int64_t last_log_time = 0;
         int64_t last_locator_write_time = 0;
         while (true) {
             if (m_interrupt) {
-                WriteBestBlock(pindex);
+                if (pindex) WriteBestBlock(pindex);
                 return;
             }
 
@@ -99,37 +162,73 @@ void BaseIndex::ThreadSync()
                 LOCK(cs_main);
                 const CBlockIndex* pindex_next = NextSyncBlock(pindex);
                 if (!pindex_next) {
-                    WriteBestBlock(pindex);
+                    if (pindex) WriteBestBlock(pindex);
                     m_best_block_index = pindex;
                     m_synced = true;
                     break;
                 }
-                pindex = pindex_next;
+                // After a reorg, commit the state at the fork point before
+                // indexing the new branch (see BlockConnected).
+                if (pindex && pindex_next->pprev != pindex && !WriteBestBlock(pindex_next->pprev)) {
+                    FatalError("%s: Failed to commit %s state at fork point %s",
+                               __func__, GetName(), pindex_next->pprev->GetBlockHash().ToString());
+                    return;
+                }
+                batch.clear();
+                while (pindex_next && batch.size() < SYNC_BATCH_SIZE) {
+                    batch.push_back(pindex_next);
+                    pindex_next = chainActive.Next(pindex_next);
+                }
             }
 
             int64_t current_time = GetTime();
             if (last_log_time + SYNC_LOG_INTERVAL < current_time) {
                 LogPrintf("Syncing %s with block chain from height %d\n",
-                          GetName(), pindex->nHeight);
+                          GetName(), batch.front()->nHeight);
                 last_log_time = current_time;
             }
 
             if (last_locator_write_time + SYNC_LOCATOR_WRITE_INTERVAL < current_time) {
-                WriteBestBlock(pindex);
+                if (pindex) WriteBestBlock(pindex);
                 last_locator_write_time = current_time;
             }
 
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
-                FatalError("%s: Failed to read block %s from disk",
-                           __func__, pindex->GetBlockHash().ToString());
-                return;
+            blocks.clear();
+            blocks.resize(parallel_writes ? 0 : batch.size());
+            std::vector<CIndexSyncCheck> checks;
+            checks.reserve(batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                checks.emplace_back(*this, batch[i], parallel_writes ? nullptr : &blocks[i]);
             }
-            if (!WriteBlock(block, pindex)) {
-                FatalError("%s: Failed to write block %s to index database",
-                           __func__, pindex->GetBlockHash().ToString());
+            bool checks_ok;
+            {
+                CCheckQueueControl<CIndexSyncCheck> control(&indexsyncqueue);
+                control.Add(checks);
+                checks_ok = control.Wait();
+            }
+            if (!checks_ok) {
+                DiscardPreparedBlocks();
+                FatalError("%s: Failed to index blocks %s to %s",
+                           __func__, batch.front()->GetBlockHash().ToString(), batch.back()->GetBlockHash().ToString());
                 return;
             }
+
+            if (parallel_writes) {
+                pindex = batch.back();
+                continue;
+            }
+            for (size_t i = 0; i < batch.size() && !m_interrupt; ++i) {
+                if (!WriteBlock(blocks[i], batch[i])) {
+                    DiscardPreparedBlocks();
+                    FatalError("%s: Failed to write block %s to index database",
+                               __func__, batch[i]->GetBlockHash().ToString());
+                    return;
+                }
+                pindex = batch[i];
+            }
+            // Blocks left unwritten on an interrupt are synced again after a
+            // restart, so what was prepared for them is of no further use.
+            DiscardPreparedBlocks();
         }
     }
 
@@ -142,9 +241,23 @@ void BaseIndex::ThreadSync()
 
 bool BaseIndex::WriteBestBlock(const CBlockIndex* block_index)
 {
-    LOCK(cs_main);
-    if (!GetDB().WriteBestBlock(chainActive.GetLocator(block_index))) {
-        return error("%s: Failed to write locator to disk", __func__);
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(block_index);
+    }
+    return Commit(locator);
+}
+
+bool BaseIndex::Commit(const CBlockLocator& locator)
+{
+    CDBBatch batch(GetDB());
+    if (!CommitInternal(batch)) {
+        return error("%s: Failed to commit latest %s state", __func__, GetName());
+    }
+    GetDB().WriteBestBlock(batch, locator);
+    if (!GetDB().WriteBatch(batch)) {
+        return error("%s: Failed to commit latest %s state", __func__, GetName());
     }
     return true;
 }
@@ -176,6 +289,15 @@ void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const
                       best_block_index->GetBlockHash().ToString());
             return;
         }
+
+        // The block is on another branch than the index. Commit the state at
+        // the fork point first, so that after a restart the index does not
+        // reuse storage still referenced by the blocks of the old branch.
+        if (best_block_index != pindex->pprev && !WriteBestBlock(pindex->pprev)) {
+            FatalError("%s: Failed to commit %s state at fork point %s",
+                       __func__, GetName(), pindex->pprev->GetBlockHash().ToString());
+            return;
+        }
     }
 
     if (WriteBlock(*block, pindex)) {
@@ -220,9 +342,7 @@ void BaseIndex::ChainStateFlushed(const CBlockLocator& locator)
         return;
     }
 
-    if (!GetDB().WriteBestBlock(locator)) {
-        error("%s: Failed to write locator to disk", __func__);
-    }
+    Commit(locator);
 }
 
 bool BaseIndex::BlockUntilSyncedToCurrentChain()
@@ -14,6 +14,14 @@
 
 class CBlockIndex;
 
+/** Default for -indexthreads, the number of threads syncing indexes (0 = auto) */
+static const int DEFAULT_INDEX_THREADS = 0;
+/** Maximum number of threads syncing indexes */
+static const int MAX_INDEX_THREADS = 32;
+
+/** Run an instance of the index sync worker thread */
+void ThreadIndexSync();
+
 /**
  * Base class for indices of blockchain data. This implements
  * CValidationInterface and ensures blocks are indexed sequentially according
@@ -32,10 +40,12 @@ protected:
         bool ReadBestBlock(CBlockLocator& locator) const;
 
         /// Write block locator of the chain that the txindex is in sync with.
-        bool WriteBestBlock(const CBlockLocator& locator);
+        void WriteBestBlock(CDBBatch& batch, const CBlockLocator& locator);
     };
 
 private:
+    friend class CIndexSyncCheck;
+
     /// Whether the index is in sync with the main chain. The flag is flipped
     /// from false to true once, after which point this starts processing
     /// ValidationInterface notifications to stay in sync.
@@ -49,14 +59,21 @@ private:
 
     /// Sync the index with the block index starting from the current best block.
     /// Intended to be run in its own thread, m_thread_sync, and can be
-    /// interrupted with m_interrupt. Once the index gets in sync, the m_synced
-    /// flag is set and the BlockConnected ValidationInterface callback takes
-    /// over and the sync thread exits.
+    /// interrupted with m_interrupt. Blocks are read, and written too if
+    /// AllowParallelWrites (otherwise prepared), by the index sync workers a
+    /// batch at a time; the locator only ever points at a block whose
+    /// ancestors are all indexed.
+    /// Once the index gets in sync, the m_synced flag is set and the
+    /// BlockConnected ValidationInterface callback takes over and the sync
+    /// thread exits.
     void ThreadSync();
 
     /// Write the current chain block locator to the DB.
     bool WriteBestBlock(const CBlockIndex* block_index);
 
+    /// Write the given block locator and other index state to the DB.
+    bool Commit(const CBlockLocator& locator);
+
 protected:
     void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex,
                         const std::vector<CTransactionRef>& txn_conflicted) override;
@@ -69,6 +86,25 @@ protected:
     /// Write update index entries for a newly connected block.
     virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
 
+    /// Whether WriteBlock may be called for the blocks of the initial sync from
+    /// several threads at once and in any order. Otherwise only reading the
+    /// blocks from disk and PrepareBlock are done in parallel.
+    virtual bool AllowParallelWrites() const { return false; }
+
+    /// Compute what WriteBlock needs for a block of the initial sync that does
+    /// not depend on the blocks before it. Unless AllowParallelWrites, this is
+    /// called from several threads at once and in any order, before WriteBlock
+    /// is called for the block on the sync thread.
+    virtual bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
+
+    /// Drop whatever PrepareBlock computed for blocks that WriteBlock was not
+    /// called for, once the sync thread is done with a batch of blocks.
+    virtual void DiscardPreparedBlocks() {}
+
+    /// Virtual method called internally by Commit that can be overridden to
+    /// atomically commit more index state along with the locator.
+    virtual bool CommitInternal(CDBBatch& batch) { return true; }
+
     virtual DB& GetDB() const = 0;
 
     /// Get the name of the index for display in logs.
@@ -0,0 +1,236 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <index/coinstatsindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_BLOCK_HEIGHT = 's';
+constexpr char DB_MUHASH = 'M';
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+namespace {
+
+/** The statistics of the UTXO set after a block, stored by height. */
+struct DBVal
+{
+    uint256 block_hash;
+    uint256 muhash;
+    uint64_t transaction_output_count;
+    uint64_t bogo_size;
+    CAmount total_amount;
+
+    DBVal() : transaction_output_count(0), bogo_size(0), total_amount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(block_hash);
+        READWRITE(muhash);
+        READWRITE(transaction_output_count);
+        READWRITE(bogo_size);
+        READWRITE(total_amount);
+    }
+};
+
+/**
+ * The coinbases of these two blocks were overwritten by the duplicate ones
+ * in blocks 91842 and 91880 (see BIP30), so they never became part of the
+ * UTXO set.
+ */
+bool IsBIP30Unspendable(const CBlockIndex* pindex)
+{
+    return (pindex->nHeight == 91722 && pindex->GetBlockHash() == uint256S("0x00000000000271a2dc26e7667f8419f2e15416dc6955e5a6c6cdf3f2574dd08e")) ||
+           (pindex->nHeight == 91812 && pindex->GetBlockHash() == uint256S("0x00000000000af0aed4792b1acee3d966af36cf5def14935db8de83d6f9306f2f"));
+}
+
+} // namespace
+
+/**
+ * Access to the coinstats index database (indexes/coinstats/)
+ *
+ * Besides the statistics at every height, the database stores the unfinalized
+ * MuHash of the block the index last wrote, so that it can continue from there.
+ * That block may be ahead of the locator of BaseIndex, or on a stale branch;
+ * the index reverses or connects blocks as needed when the next one comes in.
+ */
+class CoinStatsIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+CoinStatsIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)
+{}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<CoinStatsIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+bool CoinStatsIndex::Init()
+{
+    std::pair<uint256, MuHash3072> state;
+    if (m_db->Read(DB_MUHASH, state)) {
+        {
+            LOCK(cs_main);
+            m_state_block = LookupBlockIndex(state.first);
+        }
+        DBVal entry;
+        if (!m_state_block ||
+            !m_db->Read(std::make_pair(DB_BLOCK_HEIGHT, m_state_block->nHeight), entry) ||
+            entry.block_hash != state.first) {
+            return error("%s: Cannot read the state of %s; restart with -reindex to rebuild it", __func__, GetName());
+        }
+        m_muhash = state.second;
+        m_transaction_output_count = entry.transaction_output_count;
+        m_bogo_size = entry.bogo_size;
+        m_total_amount = entry.total_amount;
+    }
+
+    return BaseIndex::Init();
+}
+
+void CoinStatsIndex::ApplyBlock(const CBlock& block, const CBlockUndo& block_undo, const CBlockIndex* pindex, bool disconnect)
+{
+    // Outputs created by the block are added, the ones it spends removed;
+    // the other way around when disconnecting.
+    auto add = [&](const COutPoint& outpoint, const Coin& coin, bool created) {
+        const uint64_t bogo_size = GetBogoSize(coin.out.scriptPubKey);
+        if (created != disconnect) {
+            ApplyCoinHash(m_muhash, outpoint, coin);
+            m_transaction_output_count++;
+            m_bogo_size += bogo_size;
+            m_total_amount += coin.out.nValue;
+        } else {
+            RemoveCoinHash(m_muhash, outpoint, coin);
+            m_transaction_output_count--;
+            m_bogo_size -= bogo_size;
+            m_total_amount -= coin.out.nValue;
+        }
+    };
+
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        if (!tx.IsCoinBase() || !IsBIP30Unspendable(pindex)) {
+            for (uint32_t j = 0; j < tx.vout.size(); ++j) {
+                const CTxOut& out = tx.vout[j];
+                // Like AddCoins, leave out outputs that can never be spent.
+                if (out.scriptPubKey.IsUnspendable()) continue;
+                add(COutPoint(tx.GetHash(), j), Coin(out, pindex->nHeight, tx.IsCoinBase()), true);
+            }
+        }
+        if (tx.IsCoinBase()) continue;
+
+        const CTxUndo& tx_undo = block_undo.vtxundo.at(i - 1);
+        for (size_t j = 0; j < tx.vin.size(); ++j) {
+            add(tx.vin[j].prevout, tx_undo.vprevout.at(j), false);
+        }
+    }
+}
+
+bool CoinStatsIndex::ConnectBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    assert(pindex->pprev == m_state_block);
+
+    // The genesis block's outputs are not part of the UTXO set, and it has no undo data.
+    if (pindex->nHeight > 0) {
+        CBlockUndo block_undo;
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return error("%s: Failed to read undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        for (const CTxUndo& tx_undo : block_undo.vtxundo) {
+            for (const Coin& coin : tx_undo.vprevout) {
+                // Undo data written before 0.15 leaves out the height of most spent outputs.
+                if (coin.nHeight == 0) {
+                    return error("%s: Undo data for block %s is in a legacy format; restart with -reindex",
+                                 __func__, pindex->GetBlockHash().ToString());
+                }
+            }
+        }
+        ApplyBlock(block, block_undo, pindex, false);
+    }
+    m_state_block = pindex;
+
+    DBVal entry;
+    entry.block_hash = pindex->GetBlockHash();
+    m_muhash.Finalize(entry.muhash);
+    entry.transaction_output_count = m_transaction_output_count;
+    entry.bogo_size = m_bogo_size;
+    entry.total_amount = m_total_amount;
+
+    CDBBatch batch(*m_db);
+    batch.Write(std::make_pair(DB_BLOCK_HEIGHT, pindex->nHeight), entry);
+    batch.Write(DB_MUHASH, std::make_pair(entry.block_hash, m_muhash));
+    return m_db->WriteBatch(batch);
+}
+
+bool CoinStatsIndex::MoveStateTo(const CBlockIndex* pindex)
+{
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+
+    // Reverse the blocks that are not in the chain of pindex.
+    while (m_state_block && (!pindex || pindex->GetAncestor(m_state_block->nHeight) != m_state_block)) {
+        if (m_state_block->nHeight > 0) {
+            CBlock block;
+            CBlockUndo block_undo;
+            if (!ReadBlockFromDisk(block, m_state_block, consensus_params) || !UndoReadFromDisk(block_undo, m_state_block)) {
+                return error("%s: Failed to read block %s to reverse it", __func__, m_state_block->GetBlockHash().ToString());
+            }
+            ApplyBlock(block, block_undo, m_state_block, true);
+        }
+        m_state_block = m_state_block->pprev;
+    }
+
+    // Connect the ones it is missing.
+    while (m_state_block != pindex) {
+        const CBlockIndex* pindex_next = pindex->GetAncestor(m_state_block ? m_state_block->nHeight + 1 : 0);
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex_next, consensus_params)) {
+            return error("%s: Failed to read block %s", __func__, pindex_next->GetBlockHash().ToString());
+        }
+        if (!ConnectBlock(block, pindex_next)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // After a reorg, or a restart with the locator behind the stored state,
+    // the state is not at the parent of the block yet.
+    if (!MoveStateTo(pindex->pprev)) {
+        return false;
+    }
+    return ConnectBlock(block, pindex);
+}
+
+BaseIndex::DB& CoinStatsIndex::GetDB() const { return *m_db; }
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, CCoinsStats& stats) const
+{
+    DBVal entry;
+    if (!m_db->Read(std::make_pair(DB_BLOCK_HEIGHT, block_index->nHeight), entry) ||
+        entry.block_hash != block_index->GetBlockHash()) {
+        return false;
+    }
+
+    stats.nHeight = block_index->nHeight;
+    stats.hashBlock = entry.block_hash;
+    stats.hashSerialized = entry.muhash;
+    stats.nTransactionOutputs = entry.transaction_output_count;
+    stats.nBogoSize = entry.bogo_size;
+    stats.nTotalAmount = entry.total_amount;
+    stats.index_used = true;
+    return true;
+}
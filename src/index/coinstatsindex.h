@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <coinstats.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+
+class CBlockUndo;
+
+/**
+ * CoinStatsIndex maintains statistics about the UTXO set at every height of
+ * the active chain, so that gettxoutsetinfo doesn't have to walk the whole
+ * chainstate. The statistics, including a MuHash of the set, are updated
+ * incrementally from each block and its undo data.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /// The block the running statistics below are for, or null before genesis.
+    /// Only accessed from the thread writing to the index.
+    const CBlockIndex* m_state_block{nullptr};
+    MuHash3072 m_muhash;
+    uint64_t m_transaction_output_count{0};
+    uint64_t m_bogo_size{0};
+    CAmount m_total_amount{0};
+
+    /// Add (or remove, if disconnect is set) the outputs created and spent by
+    /// a block to the running statistics.
+    void ApplyBlock(const CBlock& block, const CBlockUndo& block_undo, const CBlockIndex* pindex, bool disconnect);
+
+    /// Connect a block to the running statistics and write them to the index.
+    bool ConnectBlock(const CBlock& block, const CBlockIndex* pindex);
+
+    /// Move the running statistics to the given block, reversing blocks no
+    /// longer in its chain and connecting the ones missing from it.
+    bool MoveStateTo(const CBlockIndex* pindex);
+
+protected:
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /// Look up the statistics of the UTXO set after the given block, which
+    /// must be in the active chain. Sets everything except nTransactions and
+    /// nDiskSize; the hash is the MuHash of the set.
+    bool LookUpStats(const CBlockIndex* block_index, CCoinsStats& stats) const;
+};
+
+/// The global UTXO set statistics index. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/spentindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_SPENT = 'o';
+
+std::unique_ptr<SpentIndex> g_spent_index;
+
+namespace {
+
+struct DBVal
+{
+    uint256 txid;
+    uint32_t input_index;
+    int height;
+    uint256 block_hash;
+    CAmount amount;
+
+    DBVal() : input_index(0), height(0), amount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(txid);
+        READWRITE(VARINT(input_index));
+        READWRITE(VARINT(height, VarIntMode::NONNEGATIVE_SIGNED));
+        READWRITE(block_hash);
+        READWRITE(amount);
+    }
+};
+
+} // namespace
+
+/**
+ * Access to the spent-output index database (indexes/spentindex/)
+ *
+ * An output spent in a block that was later disconnected keeps its entry until
+ * a block of the active chain spends it again. Lookups check that the block of
+ * the entry is in the active chain.
+ */
+class SpentIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+SpentIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "spentindex", n_cache_size, f_memory, f_wipe)
+{}
+
+SpentIndex::SpentIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<SpentIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+SpentIndex::~SpentIndex() {}
+
+bool SpentIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // Exclude genesis block transaction because outputs are not spendable.
+    if (pindex->nHeight == 0) return true;
+
+    CBlockUndo block_undo;
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: Failed to read undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    CDBBatch batch(*m_db);
+    DBVal val;
+    val.height = pindex->nHeight;
+    val.block_hash = pindex->GetBlockHash();
+    for (size_t i = 1; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        const CTxUndo& tx_undo = block_undo.vtxundo.at(i - 1);
+        val.txid = tx.GetHash();
+        for (uint32_t j = 0; j < tx.vin.size(); ++j) {
+            val.input_index = j;
+            val.amount = tx_undo.vprevout.at(j).out.nValue;
+            batch.Write(std::make_pair(DB_SPENT, tx.vin[j].prevout), val);
+        }
+    }
+    return m_db->WriteBatch(batch);
+}
+
+BaseIndex::DB& SpentIndex::GetDB() const { return *m_db; }
+
+bool SpentIndex::FindSpend(const COutPoint& outpoint, SpentInfo& info) const
+{
+    DBVal val;
+    if (!m_db->Read(std::make_pair(DB_SPENT, outpoint), val)) {
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = chainActive[val.height];
+        if (!pindex || pindex->GetBlockHash() != val.block_hash) {
+            return false;
+        }
+    }
+
+    info.txid = val.txid;
+    info.input_index = val.input_index;
+    info.height = val.height;
+    info.block_hash = val.block_hash;
+    info.amount = val.amount;
+    return true;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_SPENTINDEX_H
+#define BITCOIN_INDEX_SPENTINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <index/base.h>
+#include <primitives/transaction.h>
+
+/** The input spending an output, and the block containing it. */
+struct SpentInfo
+{
+    uint256 txid;
+    uint32_t input_index{0};
+    int height{0};
+    uint256 block_hash;
+    //! Value of the spent output.
+    CAmount amount{0};
+};
+
+/**
+ * SpentIndex is used to find the transaction input spending an output. The
+ * index is written to a LevelDB database and records, for every outpoint spent
+ * in the blockchain, the spending transaction and the block it is in. The
+ * spent outputs are read from the undo data of each block.
+ */
+class SpentIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool AllowParallelWrites() const override { return true; }
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "spentindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit SpentIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~SpentIndex() override;
+
+    /// Look up the input spending an output in the active chain.
+    ///
+    /// @param[in]   outpoint  The output.
+    /// @param[out]  info  The spending input and its block.
+    /// @return  true if the output is spent in the indexed part of the active chain, false otherwise
+    bool FindSpend(const COutPoint& outpoint, SpentInfo& info) const;
+};
+
+/// The global spent-output index. May be null.
+extern std::unique_ptr<SpentIndex> g_spent_index;
+
+#endif // BITCOIN_INDEX_SPENTINDEX_H
@@ -2,6 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <compressor.h>
+#include <crypto/common.h>
 #include <index/txindex.h>
 #include <shutdown.h>
 #include <ui_interface.h>
@@ -13,6 +15,8 @@
 constexpr char DB_BEST_BLOCK = 'B';
 constexpr char DB_TXINDEX = 't';
 constexpr char DB_TXINDEX_BLOCK = 'T';
+constexpr char DB_TXINDEX_SHORT = 's';
+constexpr char DB_TXINDEX_UPGRADE_BLOCK = 'U';
 
 std::unique_ptr<TxIndex> g_txindex;
 
@@ -41,6 +45,55 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+namespace {
+
+/** The part of a txid under which the transaction is indexed. */
+uint64_t GetShortTxId(const uint256& txid)
+{
+    return ReadLE64(txid.begin());
+}
+
+/**
+ * Key of a transaction in the index: its short txid, followed by its position
+ * on disk. The position tells apart the transactions that share a short txid,
+ * even within a block, and the blocks a transaction is in.
+ */
+struct DBShortTxKey
+{
+    uint64_t short_txid;
+    CDiskTxPos tx_pos;
+
+    DBShortTxKey() : short_txid(0) {}
+    DBShortTxKey(uint64_t short_txid_in, const CDiskTxPos& tx_pos_in) :
+        short_txid(short_txid_in), tx_pos(tx_pos_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_TXINDEX_SHORT);
+        ser_writedata64(s, short_txid);
+        s << tx_pos;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        if (ser_readdata8(s) != DB_TXINDEX_SHORT) {
+            throw std::ios_base::failure("Invalid format for txindex DB key");
+        }
+        short_txid = ser_readdata64(s);
+        s >> tx_pos;
+    }
+};
+
+void WriteTxPos(CDBBatch& batch, const uint256& txid, const CDiskTxPos& pos)
+{
+    // All of the entry is in the key, the value is not used.
+    batch.Write(DBShortTxKey(GetShortTxId(txid), pos), '\0');
+}
+
+} // namespace
+
 /**
  * Access to the txindex database (indexes/txindex/)
  *
@@ -49,15 +102,20 @@ struct CDiskTxPos : public CDiskBlockPos
  * A locator is used instead of a simple hash of the chain tip because blocks
  * and block index entries may not be flushed to disk until after this database
  * is updated.
+ *
+ * Transactions are keyed by the first 8 bytes of their txid and their position
+ * on disk, which takes less than half the space of keying them by the full
+ * txid. Transactions whose txids start with the same bytes are told apart
+ * by reading them from disk.
  */
 class TxIndex::DB : public BaseIndex::DB
 {
 public:
     explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
 
-    /// Read the disk location of the transaction data with the given hash. Returns false if the
-    /// transaction hash is not indexed.
-    bool ReadTxPos(const uint256& txid, CDiskTxPos& pos) const;
+    /// Read the disk locations of the transactions whose short txid is the one of the given hash.
+    /// Returns false if there are none.
+    bool ReadTxPos(const uint256& txid, std::vector<CDiskTxPos>& positions);
 
     /// Write a batch of transaction positions to the DB.
     bool WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos>>& v_pos);
@@ -65,22 +123,34 @@ public:
     /// Migrate txindex data from the block tree DB, where it may be for older nodes that have not
     /// been upgraded yet to the new database.
     bool MigrateData(CBlockTreeDB& block_tree_db, const CBlockLocator& best_locator);
+
+    /// Convert the entries keyed by full txid, as written by older versions, to short txid keys.
+    bool UpgradeToShortTxIds();
 };
 
 TxIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
     BaseIndex::DB(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe)
 {}
 
-bool TxIndex::DB::ReadTxPos(const uint256 &txid, CDiskTxPos& pos) const
+bool TxIndex::DB::ReadTxPos(const uint256 &txid, std::vector<CDiskTxPos>& positions)
 {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+    const uint64_t short_txid = GetShortTxId(txid);
+    positions.clear();
+
+    std::unique_ptr<CDBIterator> cursor(NewIterator());
+    DBShortTxKey key;
+    for (cursor->Seek(std::make_pair(DB_TXINDEX_SHORT, short_txid)); cursor->Valid(); cursor->Next()) {
+        if (!cursor->GetKey(key) || key.short_txid != short_txid) break;
+        positions.push_back(key.tx_pos);
+    }
+    return !positions.empty();
 }
 
 bool TxIndex::DB::WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos>>& v_pos)
 {
     CDBBatch batch(*this);
     for (const auto& tuple : v_pos) {
-        batch.Write(std::make_pair(DB_TXINDEX, tuple.first), tuple.second);
+        WriteTxPos(batch, tuple.first, tuple.second);
     }
     return WriteBatch(batch);
 }
@@ -185,7 +255,7 @@ bool TxIndex::DB::MigrateData(CBlockTreeDB& block_tree_db, const CBlockLocator&
         if (!cursor->GetValue(value)) {
             return error("%s: cannot parse txindex record", __func__);
         }
-        batch_newdb.Write(key, value);
+        WriteTxPos(batch_newdb, key.second, value);
         batch_olddb.Erase(key);
 
         if (batch_newdb.SizeEstimate() > batch_size || batch_olddb.SizeEstimate() > batch_size) {
@@ -223,6 +293,109 @@ bool TxIndex::DB::MigrateData(CBlockTreeDB& block_tree_db, const CBlockLocator&
     return true;
 }
 
+bool TxIndex::DB::UpgradeToShortTxIds()
+{
+    // The entries are converted in batches, each of which erases the entries
+    // keyed by full txid that it replaces, so that the upgrade can be picked up
+    // again after an interruption. Until it is complete, the locator of the
+    // index is moved to DB_TXINDEX_UPGRADE_BLOCK. An older version then finds
+    // no locator and rebuilds the index, instead of using the partially
+    // converted one.
+    std::pair<unsigned char, uint256> key;
+    std::pair<unsigned char, uint256> begin_key{DB_TXINDEX, uint256()};
+
+    std::unique_ptr<CDBIterator> cursor(NewIterator());
+    cursor->Seek(begin_key);
+    if (!cursor->Valid() || !cursor->GetKey(key) || key.first != DB_TXINDEX) {
+        return true;
+    }
+
+    CBlockLocator locator;
+    if (!Read(DB_TXINDEX_UPGRADE_BLOCK, locator)) {
+        ReadBestBlock(locator);
+        CDBBatch batch(*this);
+        batch.Write(DB_TXINDEX_UPGRADE_BLOCK, locator);
+        batch.Erase(DB_BEST_BLOCK);
+        if (!WriteBatch(batch, /*fSync=*/ true)) {
+            return error("%s: cannot write upgrade block indicator", __func__);
+        }
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading txindex database to short txids... [0%%]\n");
+    uiInterface.ShowProgress(_("Upgrading txindex database"), 0, true);
+    int report_done = 0;
+    const size_t batch_size = 1 << 24; // 16 MiB
+
+    CDBBatch batch(*this);
+    bool interrupted = false;
+    for (; cursor->Valid(); cursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            interrupted = true;
+            break;
+        }
+
+        if (!cursor->GetKey(key)) {
+            return error("%s: cannot get key from valid cursor", __func__);
+        }
+        if (key.first != DB_TXINDEX) {
+            break;
+        }
+
+        // Log progress every 10%, estimated from the high 16 bits of the txid as in MigrateData.
+        if (++count % 256 == 0) {
+            const uint256& txid = key.second;
+            uint32_t high_nibble =
+                (static_cast<uint32_t>(*(txid.begin() + 0)) << 8) +
+                (static_cast<uint32_t>(*(txid.begin() + 1)) << 0);
+            int percentage_done = (int)(high_nibble * 100.0 / 65536.0 + 0.5);
+
+            uiInterface.ShowProgress(_("Upgrading txindex database"), percentage_done, true);
+            if (report_done < percentage_done/10) {
+                LogPrintf("Upgrading txindex database to short txids... [%d%%]\n", percentage_done);
+                report_done = percentage_done/10;
+            }
+        }
+
+        CDiskTxPos value;
+        if (!cursor->GetValue(value)) {
+            return error("%s: cannot parse txindex record", __func__);
+        }
+        WriteTxPos(batch, key.second, value);
+        batch.Erase(key);
+
+        if (batch.SizeEstimate() > batch_size) {
+            if (!WriteBatch(batch)) {
+                return error("%s: cannot write txindex records", __func__);
+            }
+            batch.Clear();
+        }
+    }
+
+    // The final batch marks the upgrade as complete by restoring the locator.
+    if (!interrupted) {
+        batch.Erase(DB_TXINDEX_UPGRADE_BLOCK);
+        if (!locator.IsNull()) {
+            batch.Write(DB_BEST_BLOCK, locator);
+        }
+    }
+    if (!WriteBatch(batch, /*fSync=*/ true)) {
+        return error("%s: cannot write txindex records", __func__);
+    }
+    CompactRange(begin_key, key);
+
+    if (interrupted) {
+        LogPrintf("[CANCELLED].\n");
+        return false;
+    }
+
+    uiInterface.ShowProgress("", 100, false);
+
+    LogPrintf("[DONE].\n");
+    return true;
+}
+
 TxIndex::TxIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
     : m_db(MakeUnique<TxIndex::DB>(n_cache_size, f_memory, f_wipe))
 {}
@@ -240,6 +413,10 @@ bool TxIndex::Init()
         return false;
     }
 
+    if (!m_db->UpgradeToShortTxIds()) {
+        return false;
+    }
+
     return BaseIndex::Init();
 }
 
@@ -257,19 +434,35 @@ bool TxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
 
 BaseIndex::DB& TxIndex::GetDB() const { return *m_db; }
 
-bool TxIndex::FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRef& tx) const
+/** Read a transaction, and the header of its block, from disk. */
+static bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransactionRef& tx)
 {
-    CDiskTxPos postx;
-    if (!m_db->ReadTxPos(tx_hash, postx)) {
-        return false;
-    }
-
-    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    // Start at the index header of the block, to find out how it is stored.
+    CDiskBlockPos hpos = postx;
+    hpos.nPos -= 8;
+    CAutoFile file(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
     if (file.IsNull()) {
         return error("%s: OpenBlockFile failed", __func__);
     }
-    CBlockHeader header;
     try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+        file >> blk_start >> blk_size;
+        if (blk_size & BLOCKFILE_COMPRESSED_FLAG) {
+            // The offset is into the uncompressed block; read all of it to find the transaction.
+            CBlock block;
+            file >> CBlockCompressor(block);
+            header = block.GetBlockHeader();
+            unsigned int offset = GetSizeOfCompactSize(block.vtx.size());
+            for (CTransactionRef& block_tx : block.vtx) {
+                if (offset == postx.nTxOffset) {
+                    tx = std::move(block_tx);
+                    return true;
+                }
+                offset += ::GetSerializeSize(*block_tx, SER_DISK, CLIENT_VERSION);
+            }
+            return error("%s: No transaction at offset %u of compressed block", __func__, postx.nTxOffset);
+        }
         file >> header;
         if (fseek(file.Get(), postx.nTxOffset, SEEK_CUR)) {
             return error("%s: fseek(...) failed", __func__);
@@ -278,9 +471,35 @@ bool TxIndex::FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRe
     } catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
     }
-    if (tx->GetHash() != tx_hash) {
-        return error("%s: txid mismatch", __func__);
-    }
-    block_hash = header.GetHash();
     return true;
 }
+
+bool TxIndex::FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRef& tx) const
+{
+    std::vector<CDiskTxPos> positions;
+    if (!m_db->ReadTxPos(tx_hash, positions)) {
+        return false;
+    }
+
+    // Other transactions may share the short txid, and the transaction may be
+    // in blocks that were reorged out as well; prefer the active chain.
+    bool found = false;
+    for (const CDiskTxPos& postx : positions) {
+        CBlockHeader header;
+        CTransactionRef tx_disk;
+        // A block that was pruned or cannot be read may hold another
+        // transaction with the same short txid; keep looking.
+        if (!ReadTxFromDisk(postx, header, tx_disk)) continue;
+        if (tx_disk->GetHash() != tx_hash) continue;
+
+        tx = std::move(tx_disk);
+        block_hash = header.GetHash();
+        found = true;
+        if (positions.size() == 1) break;
+
+        LOCK(cs_main);
+        const CBlockIndex* pindex = LookupBlockIndex(block_hash);
+        if (pindex && chainActive.Contains(pindex)) break;
+    }
+    return found;
+}
@@ -12,7 +12,7 @@
 /**
  * TxIndex is used to look up transactions included in the blockchain by hash.
  * The index is written to a LevelDB database and records the filesystem
- * location of each transaction by transaction hash.
+ * location of each transaction by a short prefix of its hash.
  */
 class TxIndex final : public BaseIndex
 {
@@ -28,6 +28,8 @@ protected:
 
     bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
 
+    bool AllowParallelWrites() const override { return true; }
+
     BaseIndex::DB& GetDB() const override;
 
     const char* GetName() const override { return "txindex"; }
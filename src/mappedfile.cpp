@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <mappedfile.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+#ifndef WIN32
+    munmap(m_data, m_size);
+#endif
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const fs::path& path)
+{
+#ifdef WIN32
+    // Not implemented; callers fall back to reading the file.
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::unique_ptr<MappedFile>(new MappedFile(data, st.st_size));
+#endif
+}
+
+std::shared_ptr<const MappedFile> MappedFileCache::Get(int file)
+{
+    if (m_max_files == 0) {
+        return nullptr;
+    }
+
+    uint64_t erase_seq;
+    {
+        LOCK(m_cs);
+        for (auto it = m_files.begin(); it != m_files.end(); ++it) {
+            if (it->first == file) {
+                m_files.splice(m_files.begin(), m_files, it);
+                return it->second;
+            }
+        }
+        erase_seq = m_erase_seq;
+    }
+
+    // Map the file without holding the lock, so that readers of other files are
+    // not held up. If another thread mapped it meanwhile, keep that mapping.
+    std::shared_ptr<const MappedFile> mapped = MappedFile::Open(m_get_path(file));
+    if (!mapped) {
+        return nullptr;
+    }
+
+    LOCK(m_cs);
+    for (const auto& entry : m_files) {
+        if (entry.first == file) {
+            return entry.second;
+        }
+    }
+    // A file erased meanwhile may be deleted already; keeping it mapped would
+    // keep its disk space in use.
+    auto erased = m_erased_seq.find(file);
+    if (m_cleared_seq > erase_seq || (erased != m_erased_seq.end() && erased->second > erase_seq)) {
+        return nullptr;
+    }
+    m_files.emplace_front(file, mapped);
+    if (m_files.size() > m_max_files) {
+        m_files.pop_back();
+    }
+    return mapped;
+}
+
+void MappedFileCache::Erase(int file)
+{
+    LOCK(m_cs);
+    m_erased_seq[file] = ++m_erase_seq;
+    m_files.remove_if([file](const std::pair<int, std::shared_ptr<const MappedFile>>& entry) {
+        return entry.first == file;
+    });
+}
+
+void MappedFileCache::Clear()
+{
+    LOCK(m_cs);
+    m_cleared_seq = ++m_erase_seq;
+    m_erased_seq.clear();
+    m_files.clear();
+}
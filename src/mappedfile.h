@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <fs.h>
+#include <span.h>
+#include <sync.h>
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+
+/** A read-only memory mapping of a whole file, unmapped on destruction. */
+class MappedFile
+{
+private:
+    void* m_data;
+    size_t m_size;
+
+    MappedFile(void* data, size_t size) : m_data(data), m_size(size) {}
+
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** Map the file at path. Returns null if it is empty or cannot be mapped. */
+    static std::unique_ptr<MappedFile> Open(const fs::path& path);
+
+    Span<const unsigned char> GetData() const
+    {
+        return Span<const unsigned char>(static_cast<const unsigned char*>(m_data), m_size);
+    }
+};
+
+/**
+ * A bounded set of mappings of numbered files, like the blk?????.dat block
+ * files. When full, the least recently used mapping is dropped. Readers that
+ * got a mapping can keep using it after that; it is unmapped once the last of
+ * them is done with it.
+ *
+ * The files must not change while they are mapped, except for being deleted
+ * (see Erase).
+ */
+class MappedFileCache
+{
+private:
+    const size_t m_max_files;
+    const std::function<fs::path(int)> m_get_path;
+
+    CCriticalSection m_cs;
+    //! Mappings by file number, most recently used first.
+    std::list<std::pair<int, std::shared_ptr<const MappedFile>>> m_files GUARDED_BY(m_cs);
+    //! Counts calls to Erase and Clear, so that Get can tell whether a file
+    //! was erased while it was mapping it.
+    uint64_t m_erase_seq GUARDED_BY(m_cs) = 0;
+    //! The m_erase_seq of the last Erase of each file since the last Clear.
+    std::map<int, uint64_t> m_erased_seq GUARDED_BY(m_cs);
+    //! The m_erase_seq of the last Clear.
+    uint64_t m_cleared_seq GUARDED_BY(m_cs) = 0;
+
+public:
+    /**
+     * @param[in] max_files  Maximum number of files kept mapped; 0 disables mapping.
+     * @param[in] get_path   Function returning the path of a file by number.
+     */
+    MappedFileCache(size_t max_files, std::function<fs::path(int)> get_path)
+        : m_max_files(max_files), m_get_path(std::move(get_path)) {}
+
+    /**
+     * Get the mapping of a file, mapping it if needed. Returns null if it
+     * cannot be mapped, or if it was erased while being mapped.
+     */
+    std::shared_ptr<const MappedFile> Get(int file);
+
+    /** Drop the mapping of a file, for instance before it is deleted. */
+    void Erase(int file);
+
+    /** Drop all mappings. */
+    void Clear();
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
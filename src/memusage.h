@@ -5,7 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <flatmap.h>
 #include <indirectmap.h>
+#include <prevector.h>
 
 #include <stdlib.h>
 
@@ -165,6 +167,19 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, W>& m)
+{
+    typedef flatmap<X, Y, Z, W> map_type;
+    size_t usage = MallocUsage(map_type::SLOT_SIZE * m.bucket_count()) + MallocUsage(sizeof(void*) * m.chunk_count());
+    // Chunks grow in size at first, after which they are all equally large.
+    size_t k = 0;
+    for (; k < m.chunk_count() && map_type::chunk_size(k) != map_type::chunk_size(k + 1); ++k) {
+        usage += MallocUsage(map_type::NODE_SIZE * map_type::chunk_size(k));
+    }
+    return usage + (m.chunk_count() - k) * MallocUsage(map_type::NODE_SIZE * map_type::chunk_size(k));
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -8,6 +8,8 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <algorithm>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
@@ -166,14 +168,9 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
-bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
-    if (!IsValid())
-        return false;
-    secp256k1_pubkey pubkey;
+/** Verify a DER signature with a parsed public key. */
+static bool VerifyParsed(const secp256k1_pubkey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) {
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size())) {
-        return false;
-    }
     if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
         return false;
     }
@@ -183,6 +180,57 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
 
+bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size())) {
+        return false;
+    }
+    return VerifyParsed(pubkey, hash, vchSig);
+}
+
+std::vector<CKeyID> GetKeyIDs(const std::vector<CPubKey>& pubkeys)
+{
+    std::vector<Span<const unsigned char>> data;
+    data.reserve(pubkeys.size());
+    for (const CPubKey& pubkey : pubkeys) {
+        data.emplace_back(pubkey.data(), pubkey.size());
+    }
+    std::vector<uint160> hashes(pubkeys.size());
+    Hash160Batch(hashes.data(), data.data(), data.size());
+    return std::vector<CKeyID>(hashes.begin(), hashes.end());
+}
+
+void PubKeyParseCache::Set(const std::vector<CPubKey>& pubkeys)
+{
+    static_assert(sizeof(secp256k1_pubkey) == sizeof(Entry::parsed), "unexpected secp256k1_pubkey size");
+    m_entries.clear();
+    m_entries.reserve(pubkeys.size());
+    for (const CPubKey& pubkey : pubkeys) {
+        if (!pubkey.IsValid()) continue;
+        m_entries.emplace_back();
+        Entry& entry = m_entries.back();
+        entry.pubkey = pubkey;
+        secp256k1_pubkey parsed;
+        entry.valid = secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, pubkey.data(), pubkey.size());
+        memcpy(entry.parsed, &parsed, sizeof(parsed));
+    }
+    std::sort(m_entries.begin(), m_entries.end());
+}
+
+bool PubKeyParseCache::Verify(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) const
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), pubkey, [](const Entry& entry, const CPubKey& key) { return entry.pubkey < key; });
+    if (it == m_entries.end() || it->pubkey != pubkey) {
+        return pubkey.Verify(hash, vchSig);
+    }
+    if (!it->valid) return false;
+    secp256k1_pubkey parsed;
+    memcpy(&parsed, it->parsed, sizeof(parsed));
+    return VerifyParsed(parsed, hash, vchSig);
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != COMPACT_SIGNATURE_SIZE)
         return false;
@@ -203,6 +203,39 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/** Get the KeyIDs of many public keys at once; the same as GetID() on each, but faster. */
+std::vector<CKeyID> GetKeyIDs(const std::vector<CPubKey>& pubkeys);
+
+/**
+ * Public keys parsed in advance, to verify several signatures by the same key
+ * without parsing (and for compressed keys, decompressing) it each time. It is
+ * not modified once filled, so it can be shared by the script check threads.
+ */
+class PubKeyParseCache
+{
+private:
+    struct Entry {
+        CPubKey pubkey;
+        bool valid;
+        //! The parsed key, a secp256k1_pubkey.
+        unsigned char parsed[64];
+
+        friend bool operator<(const Entry& a, const Entry& b) { return a.pubkey < b.pubkey; }
+    };
+
+    //! Sorted by public key.
+    std::vector<Entry> m_entries;
+
+public:
+    /** Parse pubkeys, replacing the keys parsed before. */
+    void Set(const std::vector<CPubKey>& pubkeys);
+
+    size_t size() const { return m_entries.size(); }
+
+    /** Like pubkey.Verify(hash, vchSig), using the parsed key if it is cached. */
+    bool Verify(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
@@ -41,7 +41,7 @@ OptionsDialog::OptionsDialog(QWidget *parent, bool enableWallet) :
                           (MIN_DISK_SPACE_FOR_BLOCK_FILES % GiB) ? 1 : 0;
     ui->pruneSize->setMinimum(nMinDiskSpace);
     ui->threadsScriptVerif->setMinimum(-GetNumCores());
-    ui->threadsScriptVerif->setMaximum(MAX_SCRIPTCHECK_THREADS);
+    ui->threadsScriptVerif->setMaximum(std::max(MAX_SCRIPTCHECK_THREADS, GetNumCores()));
     ui->pruneWarning->setVisible(false);
     ui->pruneWarning->setStyleSheet("QLabel { color: red; }");
 
@@ -10,10 +10,17 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
+#include <clientversion.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
+#include <blockfilter.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/coinstatsindex.h>
+#include <index/spentindex.h>
 #include <index/txindex.h>
 #include <key_io.h>
 #include <policy/feerate.h>
@@ -27,6 +34,7 @@
 #include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
+#include <utxo_snapshot.h>
 #include <hash.h>
 #include <validationinterface.h>
 #include <warnings.h>
@@ -838,77 +846,6 @@ static UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
-    stats.nTransactions++;
-    for (const auto& output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0u);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 static UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -958,45 +895,113 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+static CoinStatsHashType ParseHashType(const std::string& hash_type_input)
+{
+    if (hash_type_input == "hash_serialized_2") {
+        return CoinStatsHashType::HASH_SERIALIZED;
+    } else if (hash_type_input == "muhash") {
+        return CoinStatsHashType::MUHASH;
+    } else if (hash_type_input == "none") {
+        return CoinStatsHashType::NONE;
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type_input));
+    }
+}
+
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 3)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height use_index )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time without -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"      (string, optional, default=muhash with coinstatsindex, hash_serialized_2 otherwise) Which UTXO set hash should be calculated. Options: 'hash_serialized_2' (the legacy algorithm), 'muhash', 'none'.\n"
+            "2. hash_or_height   (string or numeric, optional) The block hash or height of the target height (only available with coinstatsindex).\n"
+            "3. use_index        (boolean, optional, default=true) Use coinstatsindex, if available. It can't provide hash_serialized_2, so asking for that hash always scans the UTXO set.\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"height\":n,     (numeric) The block height (index) of the returned statistics\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the block at which these statistics are calculated\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available when coinstatsindex is used)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash of the set (only present if 'muhash' hash_type is chosen)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not available when coinstatsindex is used)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    const bool use_index = request.params[2].isNull() || request.params[2].get_bool();
+    // Default to the hash the index can provide, rather than scanning the UTXO set.
+    const CoinStatsHashType default_hash_type = use_index && g_coin_stats_index ? CoinStatsHashType::MUHASH : CoinStatsHashType::HASH_SERIALIZED;
+    const CoinStatsHashType hash_type = request.params[0].isNull() ? default_hash_type : ParseHashType(request.params[0].get_str());
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
-        ret.pushKV("height", (int64_t)stats.nHeight);
-        ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    if (use_index && g_coin_stats_index && hash_type != CoinStatsHashType::HASH_SERIALIZED) {
+        if (!g_coin_stats_index->BlockUntilSyncedToCurrentChain()) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics because coinstatsindex is still syncing");
+        }
+
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            if (request.params[1].isNull()) {
+                pindex = chainActive.Tip();
+            } else if (request.params[1].isNum()) {
+                const int height = request.params[1].get_int();
+                if (height < 0 || height > chainActive.Height()) {
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d out of range", height));
+                }
+                pindex = chainActive[height];
+            } else {
+                pindex = LookupBlockIndex(ParseHashV(request.params[1], "hash_or_height"));
+                if (!pindex) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+                }
+                if (!chainActive.Contains(pindex)) {
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
+                }
+            }
+        }
+        if (!g_coin_stats_index->LookUpStats(pindex, stats)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics from coinstatsindex");
+        }
+    } else {
+        if (!request.params[1].isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires coinstatsindex and a hash_type other than hash_serialized_2");
+        }
+        FlushStateToDisk();
+        if (!GetUTXOStats(pcoinsdbview.get(), stats, hash_type)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+    }
+
+    ret.pushKV("height", (int64_t)stats.nHeight);
+    ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    if (!stats.index_used) {
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
-        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    }
+    ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
         ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+    } else if (hash_type == CoinStatsHashType::MUHASH) {
+        ret.pushKV("muhash", stats.hashSerialized.GetHex());
+    }
+    if (!stats.index_used) {
         ret.pushKV("disk_size", stats.nDiskSize);
-        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
-    } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
     }
+    ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     return ret;
 }
 
@@ -1341,7 +1346,7 @@ static UniValue getchaintips(const JSONRPCRequest& request)
     std::set<const CBlockIndex*> setOrphans;
     std::set<const CBlockIndex*> setPrevs;
 
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const auto& item : mapBlockIndex)
     {
         if (!chainActive.Contains(item.second)) {
             setOrphans.insert(item.second);
@@ -1968,6 +1973,99 @@ static UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the UTXO set at the current tip, and the headers of the blocks leading to it, to a file.\n"
+            "A new node can start from the file with -loadtxoutset, if the chain parameters have assumeutxo\n"
+            "data for the height of the tip.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) path to the output file. If relative, will be prefixed by datadir.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,            (numeric) the number of coins written to the file\n"
+            "  \"base_hash\": \"hash\",           (string) the hash of the block the UTXO set is for\n"
+            "  \"base_height\": n,              (numeric) the height of that block\n"
+            "  \"path\": \"path\",                (string) the absolute path of the written file\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) the serialized hash of the UTXO set, as in gettxoutsetinfo\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+    }
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    // Write to a temporary file first, so that an interrupted dump does not
+    // leave a truncated snapshot at the requested path.
+    const fs::path temppath = path.string() + ".incomplete";
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists. If you are sure this is what you want, move it out of the way first");
+    }
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::unique_ptr<CCoinsViewCursor> pstatscursor;
+    const CBlockIndex* tip;
+    {
+        // Both cursors see the same database snapshot, so the coins can be
+        // written without holding cs_main.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        pstatscursor.reset(pcoinsdbview->Cursor());
+        tip = LookupBlockIndex(pcursor->GetBestBlock());
+        assert(tip);
+    }
+
+    CCoinsStats stats;
+    if (!GetUTXOStats(*pstatscursor, stats)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    }
+
+    SnapshotMetadata metadata;
+    metadata.m_base_blockhash = tip->GetBlockHash();
+    metadata.m_base_height = tip->nHeight;
+    metadata.m_coins_count = stats.nTransactionOutputs;
+
+    CAutoFile afile(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + temppath.string() + " for writing.");
+    }
+    afile << metadata;
+    for (int height = 1; height <= tip->nHeight; ++height) {
+        afile << tip->GetAncestor(height)->GetBlockHeader();
+    }
+
+    uint64_t coins_written = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+        afile << key << coin;
+        if (++coins_written % 8192 == 0) {
+            boost::this_thread::interruption_point();
+        }
+    }
+    assert(coins_written == metadata.m_coins_count);
+
+    afile.fclose();
+    if (!RenameOver(temppath, path)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + temppath.string() + " to " + path.string());
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_written", coins_written);
+    result.pushKV("base_hash", tip->GetBlockHash().GetHex());
+    result.pushKV("base_height", tip->nHeight);
+    result.pushKV("path", path.string());
+    result.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+    return result;
+}
+
 //! Search for a given set of pubkey scripts
 bool FindScriptPubKey(std::atomic<int>& scan_progress, const std::atomic<bool>& should_abort, int64_t& count, CCoinsViewCursor* cursor, const std::set<CScript>& needles, std::map<COutPoint, Coin>& out_results) {
     scan_progress = 0;
@@ -2179,6 +2277,244 @@ UniValue scantxoutset(const JSONRPCRequest& request)
     return result;
 }
 
+static UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"    (string, required) The hash of the block\n"
+            "2. \"filtertype\"   (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : (string) the hex-encoded filter data\n"
+            "  \"header\" : (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+    }
+
+    uint256 block_hash = ParseHashV(request.params[0], "blockhash");
+    std::string filtertype_name = "basic";
+    if (!request.params[1].isNull()) {
+        filtertype_name = request.params[1].get_str();
+    }
+
+    BlockFilterType filtertype;
+    if (!BlockFilterTypeByName(filtertype_name, filtertype)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    }
+
+    BlockFilterIndex* index = GetBlockFilterIndex(filtertype);
+    if (!index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + filtertype_name);
+    }
+
+    const CBlockIndex* block_index;
+    bool block_was_connected;
+    {
+        LOCK(cs_main);
+        block_index = LookupBlockIndex(block_hash);
+        if (!block_index) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        block_was_connected = block_index->IsValid(BLOCK_VALID_SCRIPTS);
+    }
+
+    bool index_ready = index->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 filter_header;
+    if (!index->LookupFilter(block_index, filter) ||
+        !index->LookupFilterHeader(block_index, filter_header)) {
+        int err_code;
+        std::string errmsg = "Filter not found.";
+
+        if (!block_was_connected) {
+            err_code = RPC_INVALID_ADDRESS_OR_KEY;
+            errmsg += " Block was not connected to active chain.";
+        } else if (!index_ready) {
+            err_code = RPC_MISC_ERROR;
+            errmsg += " Block filters are still in the process of being indexed.";
+        } else {
+            err_code = RPC_INTERNAL_ERROR;
+            errmsg += " This error is unexpected and indicates index corruption.";
+        }
+
+        throw JSONRPCError(err_code, errmsg);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(filter.GetEncodedFilter()));
+    ret.pushKV("header", filter_header.GetHex());
+    return ret;
+}
+
+static UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3) {
+        throw std::runtime_error(
+            "getaddresshistory \"address\" ( count \"start\" )\n"
+            "\nReturn the outputs paying to an address and the inputs spending them, in block order.\n"
+            "Requires -addressindex. Long histories are returned a page at a time; pass the \"next\"\n"
+            "value of a result as \"start\" to get the following page.\n"
+            "\nArguments:\n"
+            "1. \"address\"      (string, required) The address, or a hex-encoded scriptPubKey\n"
+            "2. count          (numeric, optional, default=100) The maximum number of entries to return (at most 1000)\n"
+            "3. \"start\"        (string, optional) The position to start at, as returned in \"next\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\" : [\n"
+            "    {\n"
+            "      \"type\" : \"output\"|\"spend\",  (string) Whether the transaction pays to the address or spends from it\n"
+            "      \"txid\" : \"hex\",               (string) The transaction id\n"
+            "      \"n\" : n,                      (numeric) The index of the output, or of the input spending from the address\n"
+            "      \"amount\" : x.xxx,             (numeric) The value of the output created or spent, in " + CURRENCY_UNIT + "\n"
+            "      \"height\" : n,                 (numeric) The height of the block containing the transaction\n"
+            "      \"blockhash\" : \"hex\"           (string) The hash of the block containing the transaction\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\" : \"hex\"                   (string, optional) The position of the next entry, if there are more\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 1000 \"00000065000000010000000000\"")
+            + HelpExampleRpc("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+    }
+
+    if (!g_address_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "getaddresshistory requires -addressindex");
+    }
+
+    CScript script;
+    const std::string& address = request.params[0].get_str();
+    CTxDestination dest = DecodeDestination(address);
+    if (IsValidDestination(dest)) {
+        script = GetScriptForDestination(dest);
+    } else if (IsHex(address)) {
+        std::vector<unsigned char> data(ParseHex(address));
+        script = CScript(data.begin(), data.end());
+    } else {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+    }
+
+    int count = 100;
+    if (!request.params[1].isNull()) {
+        count = request.params[1].get_int();
+        if (count < 1 || count > 1000) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "count must be between 1 and 1000");
+        }
+    }
+
+    AddressHistoryPos start;
+    if (!request.params[2].isNull()) {
+        const std::string& start_str = request.params[2].get_str();
+        if (!IsHex(start_str)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "start must be a hex string");
+        }
+        std::vector<unsigned char> data(ParseHex(start_str));
+        CDataStream ssStart(data, SER_DISK, CLIENT_VERSION);
+        try {
+            ssStart >> start;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start position");
+        }
+        if (!ssStart.empty()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start position");
+        }
+    }
+
+    if (!g_address_index->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Addresses are still in the process of being indexed");
+    }
+
+    std::vector<AddressHistoryEntry> entries;
+    bool more;
+    AddressHistoryPos next;
+    if (!g_address_index->LookupHistory(AddressIndex::GetScriptHash(script), start, count, entries, more, next)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the address index");
+    }
+
+    UniValue entries_uv(UniValue::VARR);
+    for (const AddressHistoryEntry& entry : entries) {
+        UniValue entry_uv(UniValue::VOBJ);
+        entry_uv.pushKV("type", entry.pos.spend ? "spend" : "output");
+        entry_uv.pushKV("txid", entry.txid.GetHex());
+        entry_uv.pushKV("n", (uint64_t)entry.pos.io_index);
+        entry_uv.pushKV("amount", ValueFromAmount(entry.amount));
+        entry_uv.pushKV("height", entry.pos.height);
+        entry_uv.pushKV("blockhash", entry.block_hash.GetHex());
+        entries_uv.push_back(entry_uv);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("entries", entries_uv);
+    if (more) {
+        CDataStream ssNext(SER_DISK, CLIENT_VERSION);
+        ssNext << next;
+        ret.pushKV("next", HexStr(ssNext.begin(), ssNext.end()));
+    }
+    return ret;
+}
+
+static UniValue getspentinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2) {
+        throw std::runtime_error(
+            "getspentinfo \"txid\" n\n"
+            "\nReturn the transaction input spending an output in the active chain.\n"
+            "Requires -spentindex.\n"
+            "\nArguments:\n"
+            "1. \"txid\"       (string, required) The transaction id of the output\n"
+            "2. n            (numeric, required) The output index\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\" : \"hex\",        (string) The id of the spending transaction\n"
+            "  \"vin\" : n,             (numeric) The index of the spending input\n"
+            "  \"amount\" : x.xxx,      (numeric) The value of the spent output, in " + CURRENCY_UNIT + "\n"
+            "  \"height\" : n,          (numeric) The height of the block containing the spending transaction\n"
+            "  \"blockhash\" : \"hex\"    (string) The hash of the block containing the spending transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "\"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\" 0")
+            + HelpExampleRpc("getspentinfo", "\"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", 0")
+        );
+    }
+
+    if (!g_spent_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "getspentinfo requires -spentindex");
+    }
+
+    uint256 txid = ParseHashV(request.params[0], "txid");
+    int n = request.params[1].get_int();
+    if (n < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid output index");
+    }
+
+    bool index_ready = g_spent_index->BlockUntilSyncedToCurrentChain();
+
+    SpentInfo info;
+    if (!g_spent_index->FindSpend(COutPoint(txid, n), info)) {
+        std::string errmsg = "No spending transaction found in the active chain.";
+        if (!index_ready) {
+            errmsg += " Spent outputs are still in the process of being indexed.";
+        }
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("txid", info.txid.GetHex());
+    ret.pushKV("vin", (uint64_t)info.input_index);
+    ret.pushKV("amount", ValueFromAmount(info.amount));
+    ret.pushKV("height", info.height);
+    ret.pushKV("blockhash", info.block_hash.GetHex());
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -2198,13 +2534,17 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height", "use_index"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash", "filtertype"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      {"address", "count", "start"} },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           {"txid", "n"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
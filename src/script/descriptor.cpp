@@ -279,8 +279,9 @@ public:
             if (!p->GetPubKey(pos, arg, key)) return false;
             pubkeys.push_back(key);
         }
-        for (const CPubKey& key : pubkeys) {
-            out.pubkeys.emplace(key.GetID(), std::move(key));
+        const std::vector<CKeyID> ids = GetKeyIDs(pubkeys);
+        for (size_t i = 0; i < pubkeys.size(); ++i) {
+            out.pubkeys.emplace(ids[i], pubkeys[i]);
         }
         output_scripts = std::vector<CScript>{GetScriptForMultisig(m_threshold, pubkeys)};
         return true;
@@ -10,8 +10,11 @@
 #include <crypto/sha256.h>
 #include <pubkey.h>
 #include <script/script.h>
+#include <streams.h>
 #include <uint256.h>
 
+#include <algorithm>
+
 typedef std::vector<unsigned char> valtype;
 
 namespace {
@@ -1182,6 +1185,34 @@ public:
     }
 };
 
+/** Size of an input serialized with an empty scriptSig, for legacy signature hashes. */
+static constexpr size_t LEGACY_BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
+/** Stream that writes into a SHA256 hasher, to continue from a precomputed state. */
+class CSHA256Writer
+{
+private:
+    CSHA256& sha;
+
+public:
+    explicit CSHA256Writer(CSHA256& shaIn) : sha(shaIn) {}
+
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char* pch, size_t size)
+    {
+        sha.Write((const unsigned char*)pch, size);
+    }
+
+    template <typename T>
+    CSHA256Writer& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+};
+
 template <class T>
 uint256 GetPrevoutHash(const T& txTo)
 {
@@ -1215,7 +1246,7 @@ uint256 GetOutputsHash(const T& txTo)
 } // namespace
 
 template <class T>
-PrecomputedTransactionData::PrecomputedTransactionData(const T& txTo)
+PrecomputedTransactionData::PrecomputedTransactionData(const T& txTo, bool precompute_legacy)
 {
     // Cache is calculated only for transactions with witness
     if (txTo.HasWitness()) {
@@ -1224,11 +1255,37 @@ PrecomputedTransactionData::PrecomputedTransactionData(const T& txTo)
         hashOutputs = GetOutputsHash(txTo);
         ready = true;
     }
+
+    // A legacy signature hash of an input serializes the whole transaction,
+    // so hashing them for all inputs from scratch is quadratic. The part
+    // before each input is hashed once here instead.
+    const auto is_legacy = [](const CTxIn& txin) { return txin.scriptWitness.IsNull(); };
+    if (precompute_legacy && txTo.vin.size() > 1 && std::any_of(txTo.vin.begin(), txTo.vin.end(), is_legacy)) {
+        CVectorWriter tail(SER_GETHASH, 0, m_legacy_tail, 0);
+        for (const auto& txin : txTo.vin) {
+            tail << txin.prevout << CScript() << txin.nSequence;
+        }
+        tail << txTo.vout << txTo.nLockTime;
+
+        CSHA256 sha;
+        CSHA256Writer writer(sha);
+        writer << txTo.nVersion;
+        WriteCompactSize(writer, txTo.vin.size());
+        m_legacy_midstates.reserve(txTo.vin.size());
+        for (size_t i = 0; i < txTo.vin.size(); i++) {
+            const unsigned char* input = m_legacy_tail.data() + i * LEGACY_BLANK_INPUT_SIZE;
+            // The state after the prevout of this input, and after the whole
+            // input blanked for the ones that follow.
+            m_legacy_midstates.push_back(sha);
+            m_legacy_midstates.back().Write(input, 32 + 4);
+            sha.Write(input, LEGACY_BLANK_INPUT_SIZE);
+        }
+    }
 }
 
 // explicit instantiation
-template PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo);
-template PrecomputedTransactionData::PrecomputedTransactionData(const CMutableTransaction& txTo);
+template PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo, bool precompute_legacy);
+template PrecomputedTransactionData::PrecomputedTransactionData(const CMutableTransaction& txTo, bool precompute_legacy);
 
 template <class T>
 uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1294,6 +1351,23 @@ uint256 SignatureHash(const CScript& scriptCode, const T& txTo, unsigned int nIn
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer<T> txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && cache->m_legacy_midstates.size() == txTo.vin.size() && !(nHashType & SIGHASH_ANYONECANPAY) &&
+            (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        // Continue from the state after the prevout of this input, with the
+        // rest of the input and the serialized remainder of the transaction.
+        CSHA256 sha = cache->m_legacy_midstates[nIn];
+        CSHA256Writer writer(sha);
+        txTmp.SerializeScriptCode(writer);
+        writer << txTo.vin[nIn].nSequence;
+        const size_t pos = (nIn + 1) * LEGACY_BLANK_INPUT_SIZE;
+        sha.Write(cache->m_legacy_tail.data() + pos, cache->m_legacy_tail.size() - pos);
+        writer << nHashType;
+        uint256 hash;
+        sha.Finalize(hash.begin());
+        CSHA256().Write(hash.begin(), CSHA256::OUTPUT_SIZE).Finalize(hash.begin());
+        return hash;
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
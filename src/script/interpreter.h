@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include <crypto/sha256.h>
 #include <script/script_error.h>
 #include <primitives/transaction.h>
 
@@ -124,8 +125,19 @@ struct PrecomputedTransactionData
     uint256 hashPrevouts, hashSequence, hashOutputs;
     bool ready = false;
 
+    /**
+     * For legacy SIGHASH_ALL signature hashes, which cover the whole
+     * transaction: the SHA256 state after the part of the transaction before
+     * the scriptCode of each input, and the serialization of the inputs (with
+     * empty scriptSigs), outputs and nLockTime to continue after an input.
+     * Only for transactions with several inputs that are not all segwit, and
+     * unless precompute_legacy is false (when no scripts will be checked).
+     */
+    std::vector<CSHA256> m_legacy_midstates;
+    std::vector<unsigned char> m_legacy_tail;
+
     template <class T>
-    explicit PrecomputedTransactionData(const T& tx);
+    explicit PrecomputedTransactionData(const T& tx, bool precompute_legacy = true);
 };
 
 enum class SigVersion
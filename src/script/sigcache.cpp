@@ -6,6 +6,7 @@
 #include <script/sigcache.h>
 
 #include <memusage.h>
+#include <primitives/block.h>
 #include <pubkey.h>
 #include <random.h>
 #include <uint256.h>
@@ -86,9 +87,59 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
     if (signatureCache.Get(entry, !store))
         return true;
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (m_pubkey_cache ? !m_pubkey_cache->Verify(pubkey, sighash, vchSig) : !TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
     if (store)
         signatureCache.Set(entry);
     return true;
 }
+
+/** Add the pushes of script that may be public keys. Returns the last push. */
+static std::vector<unsigned char> AddPubKeyCandidates(const CScript& script, std::vector<CPubKey>& candidates)
+{
+    std::vector<unsigned char> data;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    while (pc < script.end() && script.GetOp(pc, opcode, data)) {
+        if (data.size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE || data.size() == CPubKey::PUBLIC_KEY_SIZE) {
+            CPubKey pubkey(data.begin(), data.end());
+            if (pubkey.IsValid()) candidates.push_back(pubkey);
+        }
+    }
+    return data;
+}
+
+void ParseBlockPubKeys(const CBlock& block, PubKeyParseCache& pubkey_cache, const std::function<bool(const CTransaction&)>& skip_tx)
+{
+    // The keys are found in the scriptSigs and witnesses, and in the P2SH and
+    // witness scripts at the end of them. Keys in the outputs being spent,
+    // like for P2PK, are not looked for.
+    std::vector<CPubKey> candidates;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase() || (skip_tx && skip_tx(*tx))) continue;
+        for (const CTxIn& txin : tx->vin) {
+            std::vector<unsigned char> last = AddPubKeyCandidates(txin.scriptSig, candidates);
+            AddPubKeyCandidates(CScript(last.begin(), last.end()), candidates);
+            const std::vector<std::vector<unsigned char>>& stack = txin.scriptWitness.stack;
+            for (const std::vector<unsigned char>& item : stack) {
+                if (item.size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE || item.size() == CPubKey::PUBLIC_KEY_SIZE) {
+                    CPubKey pubkey(item.begin(), item.end());
+                    if (pubkey.IsValid()) candidates.push_back(pubkey);
+                }
+            }
+            if (!stack.empty()) {
+                AddPubKeyCandidates(CScript(stack.back().begin(), stack.back().end()), candidates);
+            }
+        }
+    }
+
+    // Keys used once are parsed when their signature is checked, as before.
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<CPubKey> reused;
+    for (size_t i = 1; i < candidates.size(); i++) {
+        if (candidates[i] == candidates[i - 1] && (reused.empty() || reused.back() != candidates[i])) {
+            reused.push_back(candidates[i]);
+        }
+    }
+    pubkey_cache.Set(reused);
+}
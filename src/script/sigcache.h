@@ -8,6 +8,7 @@
 
 #include <script/interpreter.h>
 
+#include <functional>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -17,7 +18,9 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
+class CBlock;
 class CPubKey;
+class PubKeyParseCache;
 
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
@@ -44,13 +47,23 @@ class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    //! Public keys parsed for the block being checked, if any.
+    const PubKeyParseCache* m_pubkey_cache;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool storeIn, PrecomputedTransactionData& txdataIn, const PubKeyParseCache* pubkey_cache = nullptr) : TransactionSignatureChecker(txToIn, nInIn, amountIn, txdataIn), store(storeIn), m_pubkey_cache(pubkey_cache) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
 void InitSignatureCache();
 
+/**
+ * Parse the public keys that appear more than once in the scripts of a block,
+ * so that the checks of its signatures can share them. The transactions for
+ * which skip_tx returns true (whose signatures will not be checked) are left
+ * out.
+ */
+void ParseBlockPubKeys(const CBlock& block, PubKeyParseCache& pubkey_cache, const std::function<bool(const CTransaction&)>& skip_tx = nullptr);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/addressindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static std::vector<AddressHistoryEntry> GetHistory(const AddressIndex& index, const CScript& script)
+{
+    std::vector<AddressHistoryEntry> entries;
+    bool more;
+    AddressHistoryPos next;
+    BOOST_CHECK(index.LookupHistory(AddressIndex::GetScriptHash(script), AddressHistoryPos(), 1000, entries, more, next));
+    BOOST_CHECK(!more);
+    return entries;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_initial_sync, TestChain100Setup)
+{
+    AddressIndex address_index(1 << 20, true);
+    CScript coinbase_script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!address_index.BlockUntilSyncedToCurrentChain());
+
+    address_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!address_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Every block of the test chain pays its coinbase to the same script.
+    std::vector<AddressHistoryEntry> entries = GetHistory(address_index, coinbase_script);
+    BOOST_REQUIRE_EQUAL(entries.size(), m_coinbase_txns.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        BOOST_CHECK_EQUAL(entries[i].pos.height, (int)i + 1);
+        BOOST_CHECK(!entries[i].pos.spend);
+        BOOST_CHECK(entries[i].txid == m_coinbase_txns[i]->GetHash());
+        BOOST_CHECK_EQUAL(entries[i].amount, m_coinbase_txns[i]->vout[0].nValue);
+        LOCK(cs_main);
+        BOOST_CHECK(entries[i].block_hash == chainActive[i + 1]->GetBlockHash());
+    }
+
+    // Read the history a page at a time.
+    std::vector<AddressHistoryEntry> page;
+    AddressHistoryPos start;
+    bool more = true;
+    size_t read = 0;
+    while (more) {
+        BOOST_REQUIRE(address_index.LookupHistory(AddressIndex::GetScriptHash(coinbase_script), start, 7, page, more, start));
+        BOOST_REQUIRE(page.size() == 7 || (!more && !page.empty()));
+        for (const AddressHistoryEntry& entry : page) {
+            BOOST_CHECK(entry.txid == entries[read++].txid);
+        }
+    }
+    BOOST_CHECK_EQUAL(read, entries.size());
+
+    // Spend a coinbase to another script in a new block.
+    CKey other_key;
+    other_key.MakeNewKey(true);
+    CScript other_script = GetScriptForDestination(other_key.GetPubKey().GetID());
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = other_script;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(coinbase_script, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, other_script);
+    BOOST_CHECK(address_index.BlockUntilSyncedToCurrentChain());
+
+    entries = GetHistory(address_index, coinbase_script);
+    BOOST_REQUIRE_EQUAL(entries.size(), m_coinbase_txns.size() + 1);
+    const AddressHistoryEntry& spent = entries.back();
+    BOOST_CHECK(spent.pos.spend);
+    BOOST_CHECK_EQUAL(spent.pos.height, 101);
+    BOOST_CHECK_EQUAL(spent.pos.tx_pos, 1U);
+    BOOST_CHECK_EQUAL(spent.pos.io_index, 0U);
+    BOOST_CHECK(spent.txid == spend.GetHash());
+    BOOST_CHECK_EQUAL(spent.amount, m_coinbase_txns[0]->vout[0].nValue);
+
+    // The other script got the coinbase and the output of the spend.
+    entries = GetHistory(address_index, other_script);
+    BOOST_REQUIRE_EQUAL(entries.size(), 2U);
+    BOOST_CHECK(entries[0].txid == block.vtx[0]->GetHash());
+    BOOST_CHECK(entries[1].txid == spend.GetHash());
+    BOOST_CHECK_EQUAL(entries[1].amount, 11 * CENT);
+
+    // Reorg to a longer chain without that block.
+    {
+        CValidationState state;
+        CBlockIndex* tip;
+        {
+            LOCK(cs_main);
+            tip = chainActive.Tip();
+        }
+        BOOST_CHECK(InvalidateBlock(state, Params(), tip));
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    mempool.clear();
+    for (int i = 0; i < 2; ++i) {
+        CreateAndProcessBlock({}, coinbase_script);
+    }
+    BOOST_CHECK(address_index.BlockUntilSyncedToCurrentChain());
+
+    // The entries of the stale block are gone.
+    BOOST_CHECK(GetHistory(address_index, other_script).empty());
+    entries = GetHistory(address_index, coinbase_script);
+    BOOST_REQUIRE_EQUAL(entries.size(), m_coinbase_txns.size() + 2);
+    for (const AddressHistoryEntry& entry : entries) {
+        BOOST_CHECK(!entry.pos.spend);
+    }
+
+    address_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
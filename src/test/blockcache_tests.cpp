@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+#include <chainparams.h>
+#include <test/test_bitcoin.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+static std::shared_ptr<const CBlock> MakeBlock(uint32_t nonce, size_t n_outputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(n_outputs);
+    for (CTxOut& out : tx.vout) {
+        out.scriptPubKey = CScript() << OP_TRUE;
+    }
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    block->nNonce = nonce;
+    block->vtx.push_back(MakeTransactionRef(tx));
+    return block;
+}
+
+BOOST_FIXTURE_TEST_CASE(blockcache_lru, BasicTestingSetup)
+{
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    for (uint32_t i = 0; i < 4; ++i) {
+        blocks.push_back(MakeBlock(i, 10));
+    }
+
+    // Find out how much a single block takes up.
+    BlockCache cache(1 << 20);
+    BOOST_CHECK(!cache.Get(blocks[0]->GetHash()));
+    cache.Insert(blocks[0]->GetHash(), blocks[0]);
+    BOOST_CHECK(cache.Get(blocks[0]->GetHash()) == blocks[0]);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    const size_t block_usage = cache.DynamicMemoryUsage();
+    cache.Insert(blocks[0]->GetHash(), blocks[0]);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+
+    // Room for three blocks: inserting a fourth drops the least recently used.
+    cache.SetMaxUsage(block_usage * 3);
+    cache.Insert(blocks[1]->GetHash(), blocks[1]);
+    cache.Insert(blocks[2]->GetHash(), blocks[2]);
+    BOOST_CHECK(cache.Get(blocks[0]->GetHash()));
+    cache.Insert(blocks[3]->GetHash(), blocks[3]);
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(cache.Get(blocks[0]->GetHash()));
+    BOOST_CHECK(!cache.Get(blocks[1]->GetHash()));
+    BOOST_CHECK(cache.Get(blocks[2]->GetHash()));
+    BOOST_CHECK(cache.Get(blocks[3]->GetHash()));
+
+    // Shrinking the cache drops blocks right away.
+    cache.SetMaxUsage(block_usage * 2 - 1);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(cache.Get(blocks[3]->GetHash()));
+
+    // Blocks taking up more than half of the cache are not cached.
+    std::shared_ptr<const CBlock> big_block = MakeBlock(4, 100);
+    cache.Insert(big_block->GetHash(), big_block);
+    BOOST_CHECK(!cache.Get(big_block->GetHash()));
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK(!cache.Get(blocks[3]->GetHash()));
+
+    // A cache without room does not keep anything.
+    BlockCache disabled(0);
+    disabled.Insert(blocks[0]->GetHash(), blocks[0]);
+    BOOST_CHECK(!disabled.Get(blocks[0]->GetHash()));
+}
+
+BOOST_FIXTURE_TEST_CASE(blockcache_chain, TestChain100Setup)
+{
+    // The block connected last is cached, and reading it does not copy it.
+    const CBlock block = CreateAndProcessBlock({}, CScript() << OP_TRUE);
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_CHECK(tip->GetBlockHash() == block.GetHash());
+    std::shared_ptr<const CBlock> cached = g_block_cache.Get(block.GetHash());
+    BOOST_REQUIRE(cached);
+    BOOST_CHECK(ReadBlockFromDisk(tip, Params().GetConsensus()) == cached);
+
+    // Copies read through the cache are the same as the block on disk.
+    CBlock copy;
+    BOOST_CHECK(ReadBlockFromDisk(copy, tip, Params().GetConsensus()));
+    BOOST_CHECK(copy.GetHash() == block.GetHash());
+    BOOST_CHECK(!copy.fChecked);
+
+    // Blocks that are read are only cached when asked for, so that scans
+    // over history do not evict the recent blocks.
+    g_block_cache.Clear();
+    std::shared_ptr<const CBlock> read = ReadBlockFromDisk(tip->pprev, Params().GetConsensus());
+    BOOST_REQUIRE(read);
+    BOOST_CHECK(read->GetHash() == tip->pprev->GetBlockHash());
+    BOOST_CHECK(!g_block_cache.Get(tip->pprev->GetBlockHash()));
+    BOOST_CHECK(ReadBlockFromDisk(copy, tip->pprev, Params().GetConsensus()));
+    BOOST_CHECK(!g_block_cache.Get(tip->pprev->GetBlockHash()));
+
+    read = ReadBlockFromDisk(tip->pprev, Params().GetConsensus(), /*cache_block=*/ true);
+    BOOST_REQUIRE(read);
+    BOOST_CHECK(g_block_cache.Get(tip->pprev->GetBlockHash()) == read);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,241 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/blockfilterindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilter_index_tests)
+
+static bool ComputeFilter(BlockFilterType filter_type, const CBlockIndex* block_index,
+                          BlockFilter& filter)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, block_index->GetBlockPos(), Params().GetConsensus())) {
+        return false;
+    }
+
+    CBlockUndo block_undo;
+    if (block_index->nHeight > 0 && !UndoReadFromDisk(block_undo, block_index)) {
+        return false;
+    }
+
+    filter = BlockFilter(filter_type, block, block_undo);
+    return true;
+}
+
+static bool CheckFilterLookups(BlockFilterIndex& filter_index, const CBlockIndex* block_index,
+                               uint256& last_header)
+{
+    BlockFilter expected_filter;
+    if (!ComputeFilter(filter_index.GetFilterType(), block_index, expected_filter)) {
+        BOOST_ERROR("ComputeFilter failed on block " << block_index->nHeight);
+        return false;
+    }
+
+    BlockFilter filter;
+    uint256 filter_header;
+    std::vector<BlockFilter> filters;
+    std::vector<uint256> filter_hashes;
+
+    BOOST_CHECK(filter_index.LookupFilter(block_index, filter));
+    BOOST_CHECK(filter_index.LookupFilterHeader(block_index, filter_header));
+    BOOST_CHECK(filter_index.LookupFilterRange(block_index->nHeight, block_index, filters));
+    BOOST_CHECK(filter_index.LookupFilterHashRange(block_index->nHeight, block_index,
+                                                   filter_hashes));
+
+    BOOST_CHECK_EQUAL(filters.size(), 1);
+    BOOST_CHECK_EQUAL(filter_hashes.size(), 1);
+
+    BOOST_CHECK_EQUAL(filter.GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_header, expected_filter.ComputeHeader(last_header));
+    BOOST_CHECK_EQUAL(filters[0].GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_hashes[0], expected_filter.GetHash());
+
+    filters.clear();
+    filter_hashes.clear();
+    last_header = filter_header;
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilter_index_initial_sync, TestChain100Setup)
+{
+    BlockFilterIndex filter_index(BlockFilterType::BASIC, 1 << 20, true);
+
+    uint256 last_header;
+
+    // Filter should not be found in the index before it is started.
+    {
+        LOCK(cs_main);
+
+        BlockFilter filter;
+        uint256 filter_header;
+        std::vector<BlockFilter> filters;
+        std::vector<uint256> filter_hashes;
+
+        for (const CBlockIndex* block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            BOOST_CHECK(!filter_index.LookupFilter(block_index, filter));
+            BOOST_CHECK(!filter_index.LookupFilterHeader(block_index, filter_header));
+            BOOST_CHECK(!filter_index.LookupFilterRange(block_index->nHeight, block_index, filters));
+            BOOST_CHECK(!filter_index.LookupFilterHashRange(block_index->nHeight, block_index,
+                                                            filter_hashes));
+        }
+    }
+
+    // BlockUntilSyncedToCurrentChain should return false before index is started.
+    BOOST_CHECK(!filter_index.BlockUntilSyncedToCurrentChain());
+
+    filter_index.Start();
+
+    // Allow filter index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!filter_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Check that filter index has all blocks that were in the chain before it started.
+    {
+        LOCK(cs_main);
+        const CBlockIndex* block_index;
+        for (block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            CheckFilterLookups(filter_index, block_index, last_header);
+        }
+    }
+
+    // Range lookups return the filters of the whole chain in order.
+    {
+        LOCK(cs_main);
+        std::vector<BlockFilter> filters;
+        std::vector<uint256> filter_hashes;
+        BOOST_CHECK(filter_index.LookupFilterRange(0, chainActive.Tip(), filters));
+        BOOST_CHECK(filter_index.LookupFilterHashRange(0, chainActive.Tip(), filter_hashes));
+        BOOST_REQUIRE_EQUAL(filters.size(), static_cast<size_t>(chainActive.Height() + 1));
+        BOOST_REQUIRE_EQUAL(filter_hashes.size(), filters.size());
+        for (size_t i = 0; i < filters.size(); ++i) {
+            BOOST_CHECK_EQUAL(filters[i].GetBlockHash(), chainActive[i]->GetBlockHash());
+            BOOST_CHECK_EQUAL(filter_hashes[i], filters[i].GetHash());
+        }
+        BOOST_CHECK(!filter_index.LookupFilterRange(chainActive.Height() + 1, chainActive.Tip(), filters));
+        BOOST_CHECK(!filter_index.LookupFilterRange(-1, chainActive.Tip(), filters));
+    }
+
+    // Extend the chain, then reorg it to a longer one without the new blocks.
+    CScript coinbase_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    std::vector<uint256> stale_hashes;
+    for (int i = 0; i < 2; ++i) {
+        stale_hashes.push_back(CreateAndProcessBlock({}, coinbase_script_pub_key).GetHash());
+    }
+    BOOST_CHECK(filter_index.BlockUntilSyncedToCurrentChain());
+
+    const CBlockIndex* fork_index;
+    {
+        LOCK(cs_main);
+        fork_index = chainActive.Tip()->GetAncestor(chainActive.Height() - 2);
+    }
+    {
+        CValidationState state;
+        CBlockIndex* invalidate_index;
+        {
+            LOCK(cs_main);
+            invalidate_index = LookupBlockIndex(stale_hashes[0]);
+        }
+        BOOST_CHECK(InvalidateBlock(state, Params(), invalidate_index));
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    CScript other_script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 3; ++i) {
+        CreateAndProcessBlock({}, other_script_pub_key);
+    }
+    BOOST_CHECK(filter_index.BlockUntilSyncedToCurrentChain());
+
+    // The new blocks chain on from the fork point.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(filter_index.LookupFilterHeader(fork_index, last_header));
+        for (const CBlockIndex* block_index = chainActive.Next(fork_index);
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            CheckFilterLookups(filter_index, block_index, last_header);
+        }
+    }
+
+    // The filters of the stale blocks are still found by block hash.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(filter_index.LookupFilterHeader(fork_index, last_header));
+        for (const uint256& hash : stale_hashes) {
+            const CBlockIndex* block_index = LookupBlockIndex(hash);
+            BOOST_CHECK(!chainActive.Contains(block_index));
+            CheckFilterLookups(filter_index, block_index, last_header);
+        }
+    }
+
+    filter_index.Stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilter_index_parallel_sync, TestChain100Setup)
+{
+    // Blocks spending coinbases, so that the filters also cover spent outputs
+    // (taken from the undo data).
+    CScript coinbase_script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 4; ++i) {
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(m_coinbase_txns[i]->GetHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11 * CENT;
+        spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        std::vector<unsigned char> sig;
+        uint256 hash = SignatureHash(coinbase_script, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, sig));
+        sig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << sig;
+        CreateAndProcessBlock({spend}, coinbase_script);
+    }
+
+    // The initial sync builds the filters of several batches of blocks on the
+    // index sync workers, in any order.
+    BlockFilterIndex filter_index(BlockFilterType::BASIC, 1 << 20, true);
+    filter_index.Start();
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!filter_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // The filters and the header chain match those built one block after another.
+    {
+        LOCK(cs_main);
+        uint256 last_header;
+        for (const CBlockIndex* block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            CheckFilterLookups(filter_index, block_index, last_header);
+        }
+        uint256 tip_header;
+        BOOST_CHECK(filter_index.LookupFilterHeader(chainActive.Tip(), tip_header));
+        BOOST_CHECK_EQUAL(tip_header, last_header);
+    }
+
+    filter_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockmap.h>
+#include <random.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockmap_emplace_find)
+{
+    BlockMap map;
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(uint256()) == map.end());
+
+    CBlockHeader header;
+    header.nTime = 1234;
+    const uint256 hash = header.GetHash();
+    auto inserted = map.emplace(hash, header);
+    BOOST_CHECK(inserted.second);
+    CBlockIndex* pindex = inserted.first->second;
+    BOOST_CHECK_EQUAL(pindex->nTime, 1234U);
+    BOOST_CHECK(pindex->GetBlockHash() == hash);
+    BOOST_CHECK(pindex->phashBlock == &inserted.first->first);
+    BOOST_CHECK_EQUAL(map.size(), 1U);
+    BOOST_CHECK_EQUAL(map.count(hash), 1U);
+    BOOST_CHECK(map.find(hash)->second == pindex);
+
+    // An existing entry is returned as it is.
+    inserted = map.emplace(hash);
+    BOOST_CHECK(!inserted.second);
+    BOOST_CHECK(inserted.first->second == pindex);
+    BOOST_CHECK_EQUAL(pindex->nTime, 1234U);
+    BOOST_CHECK_EQUAL(map.size(), 1U);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.count(hash), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_many)
+{
+    // Enough entries for several chunks and for growing the table a few times.
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex*> entries;
+    BlockMap map;
+    for (int i = 0; i < 10000; i++) {
+        hashes.push_back(InsecureRand256());
+        auto inserted = map.emplace(hashes.back());
+        BOOST_CHECK(inserted.second);
+        inserted.first->second->nHeight = i;
+        entries.push_back(inserted.first->second);
+    }
+    BOOST_CHECK_EQUAL(map.size(), hashes.size());
+
+    // Entries stay where they are, and are found by their hash.
+    for (size_t i = 0; i < hashes.size(); i++) {
+        auto it = map.find(hashes[i]);
+        BOOST_CHECK(it != map.end());
+        BOOST_CHECK(it->second == entries[i]);
+        BOOST_CHECK(it->first == hashes[i]);
+        BOOST_CHECK(entries[i]->GetBlockHash() == hashes[i]);
+        BOOST_CHECK_EQUAL(entries[i]->nHeight, (int)i);
+    }
+    BOOST_CHECK(map.find(InsecureRand256()) == map.end());
+
+    // Iterating visits the entries in the order they were added.
+    size_t n = 0;
+    for (const auto& entry : map) {
+        BOOST_CHECK(entry.second == entries[n]);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, entries.size());
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_reserve)
+{
+    BlockMap map;
+    map.reserve(1000);
+    map.emplace(InsecureRand256());
+    const size_t usage = map.DynamicMemoryUsage();
+    for (int i = 1; i < 1000; i++) {
+        map.emplace(InsecureRand256());
+    }
+    BOOST_CHECK_EQUAL(map.size(), 1000U);
+    // Neither the table nor the arena had to grow.
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), usage);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
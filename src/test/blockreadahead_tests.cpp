@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <test/test_bitcoin.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockreadahead_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(blockreadahead_hit)
+{
+    LOCK(cs_main);
+    const Consensus::Params& params = Params().GetConsensus();
+    const CBlockIndex* pindex = chainActive[50];
+    BlockReadAhead read_ahead;
+
+    // Nothing is handed out before a read was started.
+    BOOST_CHECK(!read_ahead.Take(pindex));
+
+    read_ahead.Start(pindex, params);
+    // Starting the same read again keeps the one in flight.
+    read_ahead.Start(pindex, params);
+    std::shared_ptr<const CBlock> block = read_ahead.Take(pindex);
+    BOOST_REQUIRE(block);
+    BOOST_CHECK(block->GetHash() == pindex->GetBlockHash());
+    // CheckBlock() ran on the block, and its success was cached.
+    BOOST_CHECK(block->fChecked);
+
+    // A block is only handed out once.
+    BOOST_CHECK(!read_ahead.Take(pindex));
+}
+
+BOOST_AUTO_TEST_CASE(blockreadahead_miss)
+{
+    LOCK(cs_main);
+    const Consensus::Params& params = Params().GetConsensus();
+    const CBlockIndex* pindex = chainActive[50];
+    const CBlockIndex* pindex_other = chainActive[51];
+    BlockReadAhead read_ahead;
+
+    // Asking for another block discards the read.
+    read_ahead.Start(pindex, params);
+    BOOST_CHECK(!read_ahead.Take(pindex_other));
+    BOOST_CHECK(!read_ahead.Take(pindex));
+
+    // Starting another read discards the one in flight.
+    read_ahead.Start(pindex, params);
+    read_ahead.Start(pindex_other, params);
+    BOOST_CHECK(!read_ahead.Take(pindex));
+    read_ahead.Start(pindex_other, params);
+    std::shared_ptr<const CBlock> block = read_ahead.Take(pindex_other);
+    BOOST_REQUIRE(block);
+    BOOST_CHECK(block->GetHash() == pindex_other->GetBlockHash());
+
+    // Blocks whose data we do not have are not read.
+    CBlockIndex index_no_data(*pindex);
+    index_no_data.nStatus &= ~BLOCK_HAVE_DATA;
+    read_ahead.Start(&index_no_data, params);
+    BOOST_CHECK(!read_ahead.Take(&index_no_data));
+
+    // A block that does not match its index entry is not handed out.
+    CBlockIndex index_wrong_hash(*pindex);
+    index_wrong_hash.phashBlock = pindex_other->phashBlock;
+    read_ahead.Start(&index_wrong_hash, params);
+    BOOST_CHECK(!read_ahead.Take(&index_wrong_hash));
+}
+
+BOOST_AUTO_TEST_CASE(blockreadahead_discard)
+{
+    LOCK(cs_main);
+    const Consensus::Params& params = Params().GetConsensus();
+    const CBlockIndex* pindex = chainActive[50];
+    BlockReadAhead read_ahead;
+
+    // This is what unloading the block index does with a read in flight:
+    // once an entry is gone, a new one may be allocated at the same address,
+    // and must not be handed the block read for the old one.
+    read_ahead.Start(pindex, params);
+    BOOST_CHECK(!read_ahead.Take(nullptr));
+    BOOST_CHECK(!read_ahead.Take(pindex));
+
+    // A read still in flight is waited for on destruction.
+    BlockReadAhead read_ahead_pending;
+    read_ahead_pending.Start(pindex, params);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,7 @@
 #include <mutex>
 #include <condition_variable>
 
+#include <map>
 #include <unordered_set>
 #include <memory>
 #include <random.h>
@@ -101,6 +102,18 @@ struct MemoryCheck {
     void swap(MemoryCheck& x) { std::swap(b, x.b); };
 };
 
+struct ThreadCheck {
+    static std::mutex m;
+    static std::map<std::thread::id, size_t> n_calls;
+    bool operator()()
+    {
+        std::lock_guard<std::mutex> l(m);
+        n_calls[std::this_thread::get_id()]++;
+        return true;
+    }
+    void swap(ThreadCheck& x){};
+};
+
 struct FrozenCleanupCheck {
     static std::atomic<uint64_t> nFrozen;
     static std::condition_variable cv;
@@ -130,6 +143,8 @@ std::mutex FrozenCleanupCheck::m{};
 std::atomic<uint64_t> FrozenCleanupCheck::nFrozen{0};
 std::condition_variable FrozenCleanupCheck::cv{};
 std::mutex UniqueCheck::m;
+std::mutex ThreadCheck::m;
+std::map<std::thread::id, size_t> ThreadCheck::n_calls;
 std::unordered_multiset<size_t> UniqueCheck::results;
 std::atomic<size_t> FakeCheckCheckCompletion::n_calls{0};
 std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
@@ -141,6 +156,7 @@ typedef CCheckQueue<FailingCheck> Failing_Queue;
 typedef CCheckQueue<UniqueCheck> Unique_Queue;
 typedef CCheckQueue<MemoryCheck> Memory_Queue;
 typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
+typedef CCheckQueue<ThreadCheck> Thread_Queue;
 
 
 /** This test case checks that the CCheckQueue works properly
@@ -381,6 +397,41 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
 }
 
 
+// Test that workers beyond the limit do not take checks, and take them
+// again once the limit is raised.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_WorkerLimit)
+{
+    auto queue = std::unique_ptr<Thread_Queue>(new Thread_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+        tg.create_thread([&]{queue->Thread();});
+    }
+    for (unsigned int limit : {0, nScriptCheckThreads}) {
+        ThreadCheck::n_calls.clear();
+        {
+            CCheckQueueControl<ThreadCheck> control(queue.get());
+            control.SetWorkerLimit(limit);
+            for (size_t i = 0; i < 1000; i++) {
+                std::vector<ThreadCheck> vChecks(10);
+                control.Add(vChecks);
+            }
+        }
+        size_t total = 0;
+        for (const auto& entry : ThreadCheck::n_calls) {
+            total += entry.second;
+        }
+        BOOST_CHECK_EQUAL(total, 10000U);
+        if (limit == 0) {
+            // Everything was done by the master.
+            BOOST_CHECK_EQUAL(ThreadCheck::n_calls.size(), 1U);
+            BOOST_CHECK_EQUAL(ThreadCheck::n_calls.count(std::this_thread::get_id()), 1U);
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+
 /** Test that CCheckQueueControl is threadsafe */
 BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
 {
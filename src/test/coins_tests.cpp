@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <coins.h>
+#include <txdb.h>
 #include <script/standard.h>
 #include <uint256.h>
 #include <undo.h>
@@ -52,7 +53,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -63,7 +64,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (erase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -588,7 +593,7 @@ void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
     CCoinsMap map;
     InsertCoinsMapEntry(map, value, flags);
-    view.BatchWrite(map, {});
+    view.BatchWrite(map, {}, true);
 }
 
 class SingleEntryCacheTest
@@ -770,6 +775,41 @@ BOOST_AUTO_TEST_CASE(ccoins_add)
     CheckAddCoin(VALUE2, VALUE3, VALUE3, DIRTY|FRESH, DIRTY|FRESH, true );
 }
 
+static void CheckEmplaceCoinFromBase(CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+    CTxOut output;
+    output.nValue = VALUE3;
+    test.cache.EmplaceCoinFromBase(OUTPOINT, Coin(std::move(output), 1, false));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_emplace_from_base)
+{
+    /* Check EmplaceCoinFromBase behavior, inserting a coin read from the base
+     * view into a cache, and checking that only absent entries are filled in,
+     * without any flags set.
+     *
+     *                       Cache   Result  Cache        Result
+     *                       Value   Value   Flags        Flags
+     */
+    CheckEmplaceCoinFromBase(ABSENT, VALUE3, NO_ENTRY   , 0          );
+    CheckEmplaceCoinFromBase(PRUNED, PRUNED, 0          , 0          );
+    CheckEmplaceCoinFromBase(PRUNED, PRUNED, FRESH      , FRESH      );
+    CheckEmplaceCoinFromBase(PRUNED, PRUNED, DIRTY      , DIRTY      );
+    CheckEmplaceCoinFromBase(PRUNED, PRUNED, DIRTY|FRESH, DIRTY|FRESH);
+    CheckEmplaceCoinFromBase(VALUE2, VALUE2, 0          , 0          );
+    CheckEmplaceCoinFromBase(VALUE2, VALUE2, FRESH      , FRESH      );
+    CheckEmplaceCoinFromBase(VALUE2, VALUE2, DIRTY      , DIRTY      );
+    CheckEmplaceCoinFromBase(VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
 void CheckWriteCoins(CAmount parent_value, CAmount child_value, CAmount expected_value, char parent_flags, char child_flags, char expected_flags)
 {
     SingleEntryCacheTest test(ABSENT, parent_value, parent_flags);
@@ -855,4 +895,163 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // Add 10 blocks of 100 coins each through a child cache, like ConnectBlock.
+    std::vector<COutPoint> outpoints;
+    for (int block = 0; block < 10; ++block) {
+        CCoinsViewCacheTest child(&cache);
+        for (int i = 0; i < 100; ++i) {
+            Coin coin;
+            coin.out.nValue = InsecureRand32();
+            coin.nHeight = block;
+            outpoints.emplace_back(InsecureRand256(), i);
+            child.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        child.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(child.Flush());
+    }
+    for (int i = 0; i < 50; ++i) {
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    }
+
+    // Syncing writes everything to the base, but keeps the unspent coins cached.
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK(base.GetBestBlock() == cache.GetBestBlock());
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        Coin coin;
+        bool have = base.GetCoin(outpoints[i], coin) && !coin.IsSpent();
+        BOOST_CHECK_EQUAL(have, i >= 50);
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(outpoints[i]), i >= 50);
+        if (i >= 50) {
+            BOOST_CHECK(coin == cache.AccessCoin(outpoints[i]));
+            BOOST_CHECK_EQUAL(cache.map().find(outpoints[i])->second.flags, 0);
+        }
+    }
+
+    // Use the coins of blocks 0 to 2 again, in a later block.
+    {
+        CCoinsViewCacheTest child(&cache);
+        BOOST_CHECK(child.Flush());
+    }
+    {
+        CCoinsViewCacheTest child(&cache);
+        for (int i = 50; i < 300; ++i) {
+            BOOST_CHECK(child.HaveCoin(outpoints[i]));
+        }
+        BOOST_CHECK(child.Flush());
+    }
+
+    // Trimming evicts the least recently used coins: those of block 3 first.
+    const size_t usage = cache.DynamicMemoryUsage();
+    cache.Trim(usage / 2);
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() < usage * 6 / 10);
+    for (int i = 50; i < 300; ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+    for (int i = 300; i < 400; ++i) {
+        BOOST_CHECK(!cache.HaveCoinInCache(outpoints[i]));
+    }
+    for (int i = 900; i < 1000; ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+    // Evicted coins are still available from the base.
+    for (size_t i = 50; i < outpoints.size(); ++i) {
+        BOOST_CHECK(cache.HaveCoin(outpoints[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_trim_age)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 200; ++i) {
+        Coin coin;
+        coin.out.nValue = InsecureRand32();
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Sync());
+
+    // Age the coins by as many blocks as a 16 bit epoch can count, then use
+    // half of them.
+    for (int block = 0; block < 65536; ++block) {
+        CCoinsViewCacheTest child(&cache);
+        BOOST_CHECK(child.Flush());
+    }
+    for (int i = 100; i < 200; ++i) {
+        BOOST_CHECK(cache.HaveCoin(outpoints[i]));
+    }
+
+    // The oldest coins are still evicted first.
+    cache.Trim(cache.DynamicMemoryUsage() - 100 * CCoinsMap::NODE_SIZE);
+    cache.SelfTest();
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(!cache.HaveCoinInCache(outpoints[i]));
+    }
+    for (int i = 100; i < 200; ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_db_background_write)
+{
+    CCoinsViewDB db(1 << 20, true);
+    db.SetBackgroundWrite(true);
+
+    std::vector<COutPoint> outpoints;
+    for (int round = 0; round < 4; ++round) {
+        CCoinsViewCache cache(&db);
+        // Spend the outputs of the previous round, and create new ones.
+        for (const COutPoint& outpoint : outpoints) {
+            BOOST_CHECK(cache.SpendCoin(outpoint));
+        }
+        std::vector<COutPoint> spent;
+        spent.swap(outpoints);
+        for (int i = 0; i < 1000; ++i) {
+            Coin coin;
+            coin.out.nValue = InsecureRand32();
+            coin.nHeight = round;
+            outpoints.emplace_back(InsecureRand256(), i);
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        const uint256 block = InsecureRand256();
+        cache.SetBestBlock(block);
+        BOOST_CHECK(cache.Flush());
+
+        // Whether or not the write has completed, the database reflects it.
+        BOOST_CHECK(db.GetBestBlock() == block);
+        for (const COutPoint& outpoint : spent) {
+            BOOST_CHECK(!db.HaveCoin(outpoint));
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            Coin coin;
+            BOOST_CHECK(db.GetCoin(outpoint, coin));
+            BOOST_CHECK_EQUAL(coin.nHeight, (uint32_t)round);
+        }
+        if (round % 2 == 0) {
+            BOOST_CHECK(db.WaitForWrite());
+            BOOST_CHECK(db.GetHeadBlocks().empty());
+        }
+    }
+
+    // A cursor only sees the completed write.
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    size_t count = 0;
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint outpoint;
+        BOOST_CHECK(cursor->GetKey(outpoint));
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, outpoints.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
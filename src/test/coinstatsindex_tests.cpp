@@ -0,0 +1,128 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coinstats.h>
+#include <consensus/validation.h>
+#include <index/coinstatsindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+static void CheckStatsMatchChainstate(CoinStatsIndex& index)
+{
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+
+    CCoinsStats index_stats, chainstate_stats;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(index.LookUpStats(chainActive.Tip(), index_stats));
+    }
+    FlushStateToDisk();
+    BOOST_REQUIRE(GetUTXOStats(pcoinsdbview.get(), chainstate_stats, CoinStatsHashType::MUHASH));
+
+    BOOST_CHECK(index_stats.index_used);
+    BOOST_CHECK_EQUAL(index_stats.nHeight, chainstate_stats.nHeight);
+    BOOST_CHECK(index_stats.hashBlock == chainstate_stats.hashBlock);
+    BOOST_CHECK(index_stats.hashSerialized == chainstate_stats.hashSerialized);
+    BOOST_CHECK_EQUAL(index_stats.nTransactionOutputs, chainstate_stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(index_stats.nBogoSize, chainstate_stats.nBogoSize);
+    BOOST_CHECK_EQUAL(index_stats.nTotalAmount, chainstate_stats.nTotalAmount);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChain100Setup)
+{
+    CoinStatsIndex coin_stats_index(1 << 20, true);
+
+    CCoinsStats stats;
+    const CBlockIndex* block_index;
+    {
+        LOCK(cs_main);
+        block_index = chainActive.Tip();
+    }
+
+    // Stats should not be found in the index before it is started.
+    BOOST_CHECK(!coin_stats_index.LookUpStats(block_index, stats));
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!coin_stats_index.BlockUntilSyncedToCurrentChain());
+
+    coin_stats_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coin_stats_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // The genesis block is indexed too, with an empty UTXO set.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(coin_stats_index.LookUpStats(chainActive.Genesis(), stats));
+    }
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 0U);
+    CheckStatsMatchChainstate(coin_stats_index);
+
+    // Spend a coinbase in a new block.
+    CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = script_pub_key;
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(script_pub_key, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, script_pub_key);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    }
+    CheckStatsMatchChainstate(coin_stats_index);
+
+    // Reorg to a longer chain without that block.
+    {
+        CValidationState state;
+        CBlockIndex* tip;
+        {
+            LOCK(cs_main);
+            tip = chainActive.Tip();
+        }
+        BOOST_CHECK(InvalidateBlock(state, Params(), tip));
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    // The spend went back to the mempool; keep its fee out of the new coinbases.
+    mempool.clear();
+    for (int i = 0; i < 2; ++i) {
+        CreateAndProcessBlock({}, GetScriptForDestination(coinbaseKey.GetPubKey().GetID()));
+    }
+    CheckStatsMatchChainstate(coin_stats_index);
+
+    // The statistics at the stale block are gone.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!coin_stats_index.LookUpStats(LookupBlockIndex(block.GetHash()), stats));
+    }
+
+    coin_stats_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
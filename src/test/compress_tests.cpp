@@ -2,7 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <clientversion.h>
 #include <compressor.h>
+#include <consensus/merkle.h>
+#include <key.h>
+#include <script/standard.h>
+#include <streams.h>
 #include <util.h>
 #include <test/test_bitcoin.h>
 
@@ -62,4 +67,101 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+BOOST_AUTO_TEST_CASE(compress_block)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript p2pkh = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.nTime = 1234567890;
+    block.nBits = 0x207fffff;
+    block.nNonce = 42;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 101 << OP_0;
+    coinbase.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+    coinbase.vout.resize(2);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = p2pkh;
+    coinbase.vout[1].nValue = 0;
+    coinbase.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(36, 0xaa);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    // Spends the coinbase, so its prevout refers back to it.
+    CMutableTransaction spend;
+    spend.nVersion = -1;
+    spend.nLockTime = 0xffffffff;
+    spend.vin.resize(2);
+    spend.vin[0].prevout = COutPoint(block.vtx[0]->GetHash(), 0);
+    spend.vin[0].nSequence = 0xfffffffd;
+    spend.vin[1].prevout = COutPoint(InsecureRand256(), 0xfffffffe);
+    spend.vin[1].nSequence = 0;
+    spend.vin[1].scriptWitness.stack = {{1, 2, 3}, {}};
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 1;
+    spend.vout[0].scriptPubKey = GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey().GetID()));
+    block.vtx.push_back(MakeTransactionRef(spend));
+
+    // Spends an output of the same block that does not exist yet, and has no witness.
+    CMutableTransaction other;
+    other.vin.resize(1);
+    other.vin[0].prevout = COutPoint(InsecureRand256(), 3);
+    other.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1);
+    other.vout.resize(1);
+    other.vout[0].nValue = MAX_MONEY;
+    other.vout[0].scriptPubKey = GetScriptForRawPubKey(key.GetPubKey());
+    block.vtx.push_back(MakeTransactionRef(other));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    BOOST_CHECK(IsBlockCompressible(block));
+    std::vector<unsigned char> compressed;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, compressed, 0) << CBlockCompressor(block);
+    BOOST_CHECK_LT(compressed.size(), ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+
+    // The block read back is the same, down to the witnesses.
+    CBlock decompressed;
+    SpanReader reader(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(compressed.data(), compressed.size()), 0);
+    reader >> CBlockCompressor(decompressed);
+    BOOST_CHECK(reader.empty());
+    CDataStream ss_block(SER_DISK, CLIENT_VERSION), ss_decompressed(SER_DISK, CLIENT_VERSION);
+    ss_block << block;
+    ss_decompressed << decompressed;
+    BOOST_CHECK(ss_block.str() == ss_decompressed.str());
+    BOOST_CHECK(decompressed.GetHash() == block.GetHash());
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        BOOST_CHECK(decompressed.vtx[i]->GetWitnessHash() == block.vtx[i]->GetWitnessHash());
+    }
+
+    // Truncated or unknown data fails to read.
+    SpanReader truncated(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(compressed.data(), compressed.size() - 1), 0);
+    BOOST_CHECK_THROW(truncated >> CBlockCompressor(decompressed), std::ios_base::failure);
+    compressed[0] = 1;
+    SpanReader unknown(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(compressed.data(), compressed.size()), 0);
+    BOOST_CHECK_THROW(unknown >> CBlockCompressor(decompressed), std::ios_base::failure);
+
+    // Counts beyond what fits in a block are not allocated.
+    std::vector<unsigned char> too_many;
+    CVectorWriter too_many_writer(SER_DISK, CLIENT_VERSION, too_many, 0);
+    too_many_writer << uint8_t(0) << block.GetBlockHeader();
+    WriteCompactSize(too_many_writer, MAX_COMPRESSED_BLOCK_TXS + 1);
+    SpanReader too_many_reader(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(too_many.data(), too_many.size()), 0);
+    BOOST_CHECK_EXCEPTION(too_many_reader >> CBlockCompressor(decompressed), std::ios_base::failure, [](const std::ios_base::failure& e) {
+        return std::string(e.what()).find("Compressed block count out of range") != std::string::npos;
+    });
+
+    // Outputs that CTxOutCompressor cannot round-trip keep a block from being compressed.
+    CMutableTransaction long_script(other);
+    long_script.vout[0].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(MAX_SCRIPT_SIZE, 0);
+    block.vtx.push_back(MakeTransactionRef(long_script));
+    BOOST_CHECK(!IsBlockCompressible(block));
+    block.vtx.back() = MakeTransactionRef(other);
+    BOOST_CHECK(IsBlockCompressible(block));
+    other.vout[0].nValue = -1;
+    block.vtx.back() = MakeTransactionRef(other);
+    BOOST_CHECK(!IsBlockCompressible(block));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
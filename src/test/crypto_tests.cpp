@@ -4,6 +4,7 @@
 
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
@@ -11,6 +12,7 @@
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -562,4 +564,124 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ripemd160_32)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[32 * 32];
+        unsigned char out1[20 * 32], out2[20 * 32];
+        for (int j = 0; j < 32 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            CRIPEMD160().Write(in + 32 * j, 32).Finalize(out1 + 20 * j);
+        }
+        RIPEMD160_32(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 20 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hash160_batch)
+{
+    for (int i = 0; i <= 100; i += 1 + i / 8) {
+        // Inputs of various sizes, including empty ones and ones over a block.
+        std::vector<std::vector<unsigned char>> in(i);
+        std::vector<Span<const unsigned char>> spans;
+        for (auto& data : in) {
+            data.resize(InsecureRandRange(100));
+            for (auto& c : data) c = InsecureRandBits(8);
+            spans.emplace_back(data.data(), data.size());
+        }
+        std::vector<uint160> out(i);
+        Hash160Batch(out.data(), spans.data(), spans.size());
+        for (int j = 0; j < i; ++j) {
+            BOOST_CHECK(out[j] == Hash160(in[j]));
+        }
+    }
+}
+
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072(tmp, sizeof(tmp));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // The hash doesn't depend on the order of insertions and removals.
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = InsecureRandBits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            uint256 out;
+            acc.Finalize(out);
+            if (order == 0) {
+                res = out;
+            } else {
+                BOOST_CHECK(res == out);
+            }
+        }
+
+        // Inserting and removing the elements one by one gives the same hash.
+        MuHash3072 acc;
+        for (int i = 0; i < 4; ++i) {
+            unsigned char tmp[32] = {(unsigned char)(table[i] & 3), 0};
+            if (table[i] & 4) {
+                acc.Remove(tmp, sizeof(tmp));
+            } else {
+                acc.Insert(tmp, sizeof(tmp));
+            }
+        }
+        uint256 out;
+        acc.Finalize(out);
+        BOOST_CHECK(res == out);
+    }
+
+    // Removing everything that was added gives the hash of the empty set.
+    MuHash3072 x = FromInt(InsecureRandBits(4));
+    MuHash3072 y = FromInt(InsecureRandBits(4));
+    MuHash3072 z;
+    z *= x;
+    z *= y;
+    z /= x;
+    z /= y;
+    uint256 empty, out;
+    MuHash3072().Finalize(empty);
+    z.Finalize(out);
+    BOOST_CHECK(out == empty);
+
+    // Finalizing doesn't change the set. Test vector shared with other implementations.
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    uint256 first, second;
+    acc.Finalize(first);
+    acc.Finalize(second);
+    BOOST_CHECK(first == second);
+    BOOST_CHECK(first == uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // Serialization round trips the unfinalized state.
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    MuHash3072 w = FromInt(3);
+    w /= FromInt(4);
+    ss << w;
+    MuHash3072 w2;
+    ss >> w2;
+    w2 *= FromInt(4);
+    w2.Finalize(out);
+    FromInt(3).Finalize(first);
+    BOOST_CHECK(out == first);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
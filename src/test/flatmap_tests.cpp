@@ -0,0 +1,164 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flatmap.h>
+#include <memusage.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+/** Hash with many collisions, to exercise probing and tombstones. */
+struct BadHash
+{
+    size_t operator()(uint32_t key) const { return key % 97; }
+};
+
+static void CheckEqual(const flatmap<uint32_t, std::string, BadHash>& map, const std::map<uint32_t, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    BOOST_CHECK_EQUAL(map.empty(), expected.empty());
+    size_t count = 0;
+    for (const auto& entry : map) {
+        auto it = expected.find(entry.first);
+        BOOST_CHECK(it != expected.end());
+        BOOST_CHECK_EQUAL(it->second, entry.second);
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_random_test)
+{
+    flatmap<uint32_t, std::string, BadHash> map;
+    std::map<uint32_t, std::string> expected;
+
+    for (int i = 0; i < 20000; ++i) {
+        uint32_t key = InsecureRandRange(2000);
+        switch (InsecureRandRange(5)) {
+        case 0:
+        case 1: {
+            std::string value = std::to_string(InsecureRand32());
+            auto ret = map.emplace(key, value);
+            auto ret_expected = expected.emplace(key, value);
+            BOOST_CHECK_EQUAL(ret.second, ret_expected.second);
+            BOOST_CHECK_EQUAL(ret.first->first, key);
+            BOOST_CHECK_EQUAL(ret.first->second, ret_expected.first->second);
+            break;
+        }
+        case 2: {
+            std::string value = std::to_string(InsecureRand32());
+            map[key] = value;
+            expected[key] = value;
+            break;
+        }
+        case 3: {
+            auto it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), expected.erase(key) == 1);
+            if (it != map.end()) map.erase(it);
+            break;
+        }
+        case 4: {
+            BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+            auto it = map.find(key);
+            if (it != map.end()) BOOST_CHECK_EQUAL(it->second, expected[key]);
+            break;
+        }
+        }
+        if (InsecureRandRange(2000) == 0) {
+            CheckEqual(map, expected);
+        }
+        if (InsecureRandRange(5000) == 0) {
+            map.shrink_to_fit();
+            CheckEqual(map, expected);
+        }
+    }
+    CheckEqual(map, expected);
+
+    // Erasing while iterating visits every entry exactly once.
+    size_t erased = 0;
+    for (auto it = map.begin(); it != map.end(); ++erased) {
+        BOOST_CHECK_EQUAL(expected.erase(it->first), 1U);
+        it = map.erase(it);
+    }
+    BOOST_CHECK(expected.empty());
+    CheckEqual(map, expected);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_stable_references)
+{
+    flatmap<uint32_t, std::unique_ptr<int>> map;
+    std::vector<const std::unique_ptr<int>*> refs;
+    for (uint32_t i = 0; i < 10000; ++i) {
+        auto ret = map.emplace(i, std::unique_ptr<int>(new int(i)));
+        BOOST_CHECK(ret.second);
+        refs.push_back(&ret.first->second);
+    }
+    // Entries do not move as the map grows.
+    for (uint32_t i = 0; i < 10000; ++i) {
+        BOOST_CHECK_EQUAL(&map.find(i)->second, refs[i]);
+        BOOST_CHECK_EQUAL(**refs[i], (int)i);
+    }
+
+    // Erased nodes are reused before the map grows further.
+    size_t chunks = map.chunk_count();
+    for (uint32_t i = 0; i < 10000; i += 2) {
+        map.erase(map.find(i));
+    }
+    for (uint32_t i = 10000; i < 15000; ++i) {
+        map.emplace(i, std::unique_ptr<int>(new int(i)));
+    }
+    BOOST_CHECK_EQUAL(map.size(), 10000U);
+    BOOST_CHECK_EQUAL(map.chunk_count(), chunks);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::DynamicUsage(flatmap<uint32_t, std::unique_ptr<int>>()));
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_shrink_to_fit)
+{
+    flatmap<uint32_t, std::unique_ptr<int>> map;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        map.emplace(i, std::unique_ptr<int>(new int(i)));
+    }
+    const size_t full_usage = memusage::DynamicUsage(map);
+
+    // Keep every tenth entry; erasing alone releases no memory.
+    for (uint32_t i = 0; i < 20000; ++i) {
+        if (i % 10 != 0) map.erase(map.find(i));
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), full_usage);
+
+    map.shrink_to_fit();
+    BOOST_CHECK_EQUAL(map.size(), 2000U);
+    BOOST_CHECK(memusage::DynamicUsage(map) * 5 < full_usage);
+    for (uint32_t i = 0; i < 20000; ++i) {
+        auto it = map.find(i);
+        BOOST_CHECK_EQUAL(it != map.end(), i % 10 == 0);
+        if (it != map.end()) BOOST_CHECK_EQUAL(*it->second, (int)i);
+    }
+
+    // The map stays usable.
+    for (uint32_t i = 20000; i < 21000; ++i) {
+        BOOST_CHECK(map.emplace(i, std::unique_ptr<int>(new int(i))).second);
+    }
+    BOOST_CHECK_EQUAL(map.size(), 3000U);
+
+    for (uint32_t i = 0; i < 21000; ++i) {
+        auto it = map.find(i);
+        if (it != map.end()) map.erase(it);
+    }
+    map.shrink_to_fit();
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::DynamicUsage(flatmap<uint32_t, std::unique_ptr<int>>()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,7 +5,9 @@
 #include <key.h>
 
 #include <key_io.h>
+#include <primitives/block.h>
 #include <script/script.h>
+#include <script/sigcache.h>
 #include <uint256.h>
 #include <util.h>
 #include <utilstrencodings.h>
@@ -188,4 +190,67 @@ BOOST_AUTO_TEST_CASE(key_signature_tests)
     BOOST_CHECK(found_small);
 }
 
+BOOST_AUTO_TEST_CASE(pubkey_parse_cache)
+{
+    CKey key1 = DecodeSecret(strSecret1);
+    CKey key1C = DecodeSecret(strSecret1C);
+    CKey key2C = DecodeSecret(strSecret2C);
+    CPubKey pubkey1 = key1.GetPubKey();
+    CPubKey pubkey1C = key1C.GetPubKey();
+    CPubKey pubkey2C = key2C.GetPubKey();
+    // Not a point on the curve.
+    std::vector<unsigned char> bad_data(CPubKey::COMPRESSED_PUBLIC_KEY_SIZE, 0xff);
+    bad_data[0] = 0x02;
+    CPubKey bad(bad_data.begin(), bad_data.end());
+    BOOST_CHECK(bad.IsValid() && !bad.IsFullyValid());
+
+    uint256 hash = InsecureRand256();
+    std::vector<unsigned char> sig1, sig1C, sig2C;
+    BOOST_CHECK(key1.Sign(hash, sig1));
+    BOOST_CHECK(key1C.Sign(hash, sig1C));
+    BOOST_CHECK(key2C.Sign(hash, sig2C));
+
+    PubKeyParseCache cache;
+    cache.Set({pubkey1C, bad, pubkey1});
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+    // The results are those of CPubKey::Verify, for keys in the cache or not.
+    BOOST_CHECK(cache.Verify(pubkey1, hash, sig1));
+    BOOST_CHECK(cache.Verify(pubkey1C, hash, sig1C));
+    BOOST_CHECK(cache.Verify(pubkey2C, hash, sig2C));
+    BOOST_CHECK(!cache.Verify(pubkey1, hash, sig2C));
+    BOOST_CHECK(!cache.Verify(pubkey1C, hash, sig2C));
+    BOOST_CHECK(!cache.Verify(pubkey2C, hash, sig1C));
+    BOOST_CHECK(!cache.Verify(pubkey1C, InsecureRand256(), sig1C));
+    BOOST_CHECK(!cache.Verify(bad, hash, sig1C));
+
+    // Only the keys used more than once in the block are parsed in advance.
+    CMutableTransaction coinbase, tx1, tx2;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << ToByteVector(pubkey1) << ToByteVector(pubkey1);
+    tx1.vin.resize(2);
+    tx1.vin[0].prevout.n = 0;
+    tx1.vin[0].scriptSig = CScript() << sig1C << ToByteVector(pubkey1C);
+    tx1.vin[1].prevout.n = 1;
+    tx1.vin[1].scriptWitness.stack = {sig2C, ToByteVector(pubkey2C)};
+    tx2.vin.resize(2);
+    tx2.vin[0].prevout.n = 2;
+    CScript redeem_script = CScript() << OP_1 << ToByteVector(pubkey2C) << ToByteVector(pubkey1) << OP_2 << OP_CHECKMULTISIG;
+    tx2.vin[0].scriptSig = CScript() << OP_0 << sig2C << ToByteVector(redeem_script);
+    tx2.vin[1].prevout.n = 3;
+    tx2.vin[1].scriptWitness.stack = {sig1C, ToByteVector(pubkey1C)};
+    CBlock block;
+    block.vtx = {MakeTransactionRef(coinbase), MakeTransactionRef(tx1), MakeTransactionRef(tx2)};
+    ParseBlockPubKeys(block, cache);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(cache.Verify(pubkey1C, hash, sig1C));
+    BOOST_CHECK(cache.Verify(pubkey2C, hash, sig2C));
+    BOOST_CHECK(cache.Verify(pubkey1, hash, sig1));
+
+    // Without tx2, whose scripts are cached, no key is used twice.
+    const uint256 tx2_hash = block.vtx[2]->GetHash();
+    ParseBlockPubKeys(block, cache, [&](const CTransaction& tx) { return tx.GetHash() == tx2_hash; });
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <clientversion.h>
+#include <mappedfile.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mappedfile_tests, BasicTestingSetup)
+
+static fs::path TestFilePath(const fs::path& dir, int file)
+{
+    return dir / strprintf("mapped%d.dat", file);
+}
+
+static void WriteTestFile(const fs::path& dir, int file, const std::vector<unsigned char>& data)
+{
+    CAutoFile out(fsbridge::fopen(TestFilePath(dir, file), "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!out.IsNull());
+    out.write((const char*)data.data(), data.size());
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(mappedfile_read)
+{
+    const fs::path dir = SetDataDir("mappedfile_read");
+    std::vector<unsigned char> data{1, 2, 3, 4, 5};
+    WriteTestFile(dir, 0, data);
+
+    std::unique_ptr<MappedFile> mapped = MappedFile::Open(TestFilePath(dir, 0));
+    BOOST_REQUIRE(mapped);
+    Span<const unsigned char> span = mapped->GetData();
+    BOOST_CHECK(std::vector<unsigned char>(span.begin(), span.end()) == data);
+
+    // Missing and empty files are not mapped.
+    BOOST_CHECK(!MappedFile::Open(TestFilePath(dir, 1)));
+    WriteTestFile(dir, 1, {});
+    BOOST_CHECK(!MappedFile::Open(TestFilePath(dir, 1)));
+}
+
+BOOST_AUTO_TEST_CASE(mappedfile_block)
+{
+    const fs::path dir = SetDataDir("mappedfile_block");
+    // Blocks read from a mapped file are the same as from the file itself.
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1234;
+    block.nNonce = 42;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 50;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    std::vector<unsigned char> data{0xff, 0xff};
+    CVectorWriter(SER_DISK, CLIENT_VERSION, data, data.size()) << block;
+    WriteTestFile(dir, 0, data);
+
+    std::unique_ptr<MappedFile> mapped = MappedFile::Open(TestFilePath(dir, 0));
+    BOOST_REQUIRE(mapped);
+    CBlock read_mapped, read_file;
+    SpanReader(SER_DISK, CLIENT_VERSION, mapped->GetData(), 2) >> read_mapped;
+    CAutoFile filein(fsbridge::fopen(TestFilePath(dir, 0), "rb"), SER_DISK, CLIENT_VERSION);
+    filein.ignore(2);
+    filein >> read_file;
+    BOOST_CHECK(read_mapped.GetHash() == block.GetHash());
+    BOOST_CHECK(read_mapped.GetHash() == read_file.GetHash());
+    BOOST_CHECK(*read_mapped.vtx[0] == *block.vtx[0]);
+
+    // Reading past the end of the mapping fails instead of touching other memory.
+    BOOST_CHECK_THROW(SpanReader(SER_DISK, CLIENT_VERSION, mapped->GetData().first(data.size() - 1), 2) >> read_mapped, std::ios_base::failure);
+    BOOST_CHECK_THROW(SpanReader(SER_DISK, CLIENT_VERSION, mapped->GetData(), data.size() + 1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(mappedfile_cache)
+{
+    const fs::path dir = SetDataDir("mappedfile_cache");
+    auto get_path = [&dir](int file) { return TestFilePath(dir, file); };
+    for (int i = 0; i < 3; ++i) {
+        WriteTestFile(dir, i, {(unsigned char)i});
+    }
+
+    MappedFileCache cache(2, get_path);
+    std::shared_ptr<const MappedFile> file0 = cache.Get(0);
+    BOOST_REQUIRE(file0);
+    BOOST_CHECK_EQUAL(file0->GetData()[0], 0);
+    BOOST_CHECK(cache.Get(0) == file0);
+    BOOST_CHECK(!cache.Get(3));
+
+    // Mapping two more files evicts the least recently used one, which stays
+    // usable by the readers that have it.
+    BOOST_REQUIRE(cache.Get(1));
+    BOOST_REQUIRE(cache.Get(2));
+    BOOST_CHECK(cache.Get(0) != file0);
+    BOOST_CHECK_EQUAL(file0->GetData()[0], 0);
+
+    // Erased files are mapped again on the next access.
+    std::shared_ptr<const MappedFile> file2 = cache.Get(2);
+    cache.Erase(2);
+    BOOST_CHECK(cache.Get(2) != file2);
+    fs::remove(TestFilePath(dir, 2));
+    cache.Erase(2);
+    BOOST_CHECK(!cache.Get(2));
+
+    // A file erased while it is being mapped is not kept mapped.
+    std::function<void()> while_mapping;
+    MappedFileCache racing(2, [&](int file) {
+        if (while_mapping) while_mapping();
+        return TestFilePath(dir, file);
+    });
+    while_mapping = [&] { racing.Erase(0); };
+    BOOST_CHECK(!racing.Get(0));
+    while_mapping = nullptr;
+    std::shared_ptr<const MappedFile> racing_file0 = racing.Get(0);
+    BOOST_REQUIRE(racing_file0);
+    BOOST_CHECK(racing.Get(0) == racing_file0);
+    // Erasing another file meanwhile does not matter, clearing the cache does.
+    while_mapping = [&] { racing.Erase(0); };
+    BOOST_REQUIRE(racing.Get(1));
+    while_mapping = nullptr;
+    BOOST_CHECK(racing.Get(1) == racing.Get(1));
+    racing.Erase(1);
+    while_mapping = [&] { racing.Clear(); };
+    BOOST_CHECK(!racing.Get(1));
+    while_mapping = nullptr;
+    BOOST_CHECK(racing.Get(1));
+
+    // A cache without room does not map anything.
+    MappedFileCache disabled(0, get_path);
+    BOOST_CHECK(!disabled.Get(0));
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
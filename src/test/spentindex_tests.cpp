@@ -0,0 +1,112 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/spentindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(spentindex_tests)
+
+BOOST_FIXTURE_TEST_CASE(spentindex_initial_sync, TestChain100Setup)
+{
+    SpentIndex spent_index(1 << 20, true);
+    CScript coinbase_script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Spend a coinbase before the index is started.
+    auto make_spend = [&](const CTransactionRef& coinbase) {
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(coinbase->GetHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11 * CENT;
+        spend.vout[0].scriptPubKey = coinbase_script;
+        std::vector<unsigned char> sig;
+        uint256 hash = SignatureHash(coinbase_script, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, sig));
+        sig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << sig;
+        return spend;
+    };
+    const CMutableTransaction spend1 = make_spend(m_coinbase_txns[0]);
+    const CBlock block1 = CreateAndProcessBlock({spend1}, coinbase_script);
+    const COutPoint outpoint1(m_coinbase_txns[0]->GetHash(), 0);
+
+    SpentInfo info;
+
+    // Spends should not be found in the index before it is started.
+    BOOST_CHECK(!spent_index.FindSpend(outpoint1, info));
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!spent_index.BlockUntilSyncedToCurrentChain());
+
+    spent_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!spent_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    BOOST_REQUIRE(spent_index.FindSpend(outpoint1, info));
+    BOOST_CHECK(info.txid == spend1.GetHash());
+    BOOST_CHECK_EQUAL(info.input_index, 0U);
+    BOOST_CHECK_EQUAL(info.height, 101);
+    BOOST_CHECK(info.block_hash == block1.GetHash());
+    BOOST_CHECK_EQUAL(info.amount, m_coinbase_txns[0]->vout[0].nValue);
+
+    // Unspent outputs are not found.
+    BOOST_CHECK(!spent_index.FindSpend(COutPoint(m_coinbase_txns[1]->GetHash(), 0), info));
+    BOOST_CHECK(!spent_index.FindSpend(COutPoint(spend1.GetHash(), 0), info));
+
+    // Check that new spends are indexed as blocks are connected.
+    const CMutableTransaction spend2 = make_spend(m_coinbase_txns[1]);
+    const CBlock block2 = CreateAndProcessBlock({spend2}, coinbase_script);
+    BOOST_CHECK(spent_index.BlockUntilSyncedToCurrentChain());
+    const COutPoint outpoint2(m_coinbase_txns[1]->GetHash(), 0);
+    BOOST_REQUIRE(spent_index.FindSpend(outpoint2, info));
+    BOOST_CHECK(info.txid == spend2.GetHash());
+    BOOST_CHECK(info.block_hash == block2.GetHash());
+
+    // Reorg to a longer chain without that block.
+    {
+        CValidationState state;
+        CBlockIndex* tip;
+        {
+            LOCK(cs_main);
+            tip = chainActive.Tip();
+        }
+        BOOST_CHECK(InvalidateBlock(state, Params(), tip));
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    mempool.clear();
+    for (int i = 0; i < 2; ++i) {
+        CreateAndProcessBlock({}, coinbase_script);
+    }
+    BOOST_CHECK(spent_index.BlockUntilSyncedToCurrentChain());
+
+    // The spend in the stale block is not found, the one before the fork still is.
+    BOOST_CHECK(!spent_index.FindSpend(outpoint2, info));
+    BOOST_CHECK(spent_index.FindSpend(outpoint1, info));
+
+    // Spending the output again in the active chain replaces the stale entry.
+    const CBlock block3 = CreateAndProcessBlock({spend2}, coinbase_script);
+    BOOST_CHECK(spent_index.BlockUntilSyncedToCurrentChain());
+    BOOST_REQUIRE(spent_index.FindSpend(outpoint2, info));
+    BOOST_CHECK(info.block_hash == block3.GetHash());
+    BOOST_CHECK_EQUAL(info.height, 104);
+
+    spent_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
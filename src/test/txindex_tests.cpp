@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <dbwrapper.h>
 #include <index/txindex.h>
 #include <script/standard.h>
 #include <test/test_bitcoin.h>
@@ -63,4 +64,72 @@ BOOST_FIXTURE_TEST_CASE(txindex_initial_sync, TestChain100Setup)
     }
 }
 
+/** Position of a transaction as keyed by full txid in older versions. */
+struct LegacyTxPos
+{
+    CDiskBlockPos block_pos;
+    unsigned int tx_offset;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(block_pos);
+        READWRITE(VARINT(tx_offset));
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(txindex_upgrade_short_txids, TestChain100Setup)
+{
+    // A txid sharing the first 8 bytes with the one of the first coinbase.
+    uint256 other_txid = m_coinbase_txns[0]->GetHash();
+    *(other_txid.end() - 1) ^= 1;
+
+    // Write an index keyed by full txid, as older versions did.
+    {
+        CDBWrapper db(GetDataDir() / "indexes" / "txindex", 1 << 20);
+        CDBBatch batch(db);
+        LOCK(cs_main);
+        for (int height = 1; height <= chainActive.Height(); ++height) {
+            LegacyTxPos pos{chainActive[height]->GetBlockPos(), 1};
+            batch.Write(std::make_pair('t', m_coinbase_txns[height - 1]->GetHash()), pos);
+        }
+        // Have the other txid point at another transaction.
+        LegacyTxPos pos{chainActive[2]->GetBlockPos(), 1};
+        batch.Write(std::make_pair('t', other_txid), pos);
+        batch.Write('B', chainActive.GetLocator());
+        BOOST_REQUIRE(db.WriteBatch(batch));
+    }
+
+    {
+        TxIndex txindex(1 << 20);
+        txindex.Start();
+        // The locator was kept, so the index is in sync right away.
+        BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+
+        CTransactionRef tx_disk;
+        uint256 block_hash;
+        for (const auto& txn : m_coinbase_txns) {
+            if (!txindex.FindTx(txn->GetHash(), block_hash, tx_disk)) {
+                BOOST_ERROR("FindTx failed");
+            } else if (tx_disk->GetHash() != txn->GetHash()) {
+                BOOST_ERROR("Read incorrect tx");
+            }
+        }
+        BOOST_CHECK(!txindex.FindTx(other_txid, block_hash, tx_disk));
+
+        txindex.Stop();
+    }
+
+    // The entries keyed by full txid are gone.
+    CDBWrapper db(GetDataDir() / "indexes" / "txindex", 1 << 20);
+    std::unique_ptr<CDBIterator> cursor(db.NewIterator());
+    cursor->Seek(std::make_pair('t', uint256()));
+    std::pair<char, uint256> key;
+    BOOST_CHECK(!cursor->Valid() || !cursor->GetKey(key) || key.first != 't');
+    CBlockLocator locator;
+    BOOST_CHECK(db.Read('B', locator));
+    BOOST_CHECK(!db.Exists('U'));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <functional>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -28,6 +30,7 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_DUMP = 'D';
 
 namespace {
 
@@ -53,19 +56,42 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const std::string& name) : db(GetDataDir() / name, nCacheSize, fMemory, fWipe, true)
+{
+}
+
+CCoinsViewDB::~CCoinsViewDB()
 {
+    WaitForWrite();
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        LOCK(cs_write_coins);
+        CCoinsMap::const_iterator it;
+        if (m_write_coins && (it = m_write_coins->find(outpoint)) != m_write_coins->end()) {
+            if (it->second.coin.IsSpent()) return false;
+            coin = it->second.coin;
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        LOCK(cs_write_coins);
+        CCoinsMap::const_iterator it;
+        if (m_write_coins && (it = m_write_coins->find(outpoint)) != m_write_coins->end()) return !it->second.coin.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_write_coins);
+        if (!m_write_block.IsNull()) return m_write_block;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -80,13 +106,10 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
-    size_t count = 0;
-    size_t changed = 0;
-    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
-    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
     assert(!hashBlock.IsNull());
+    LOCK(cs_writer);
+    if (!WaitForWriteLocked()) return false;
 
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
@@ -98,6 +121,68 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
     }
 
+    if (!m_background_write) {
+        return WriteCoins(mapCoins, hashBlock, old_tip, erase);
+    }
+
+    std::shared_ptr<CCoinsMap> coins = std::make_shared<CCoinsMap>();
+    if (erase) {
+        coins->swap(mapCoins);
+    } else {
+        // The caller keeps using its entries, so the writer needs a copy.
+        for (const auto& entry : mapCoins) {
+            if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+                coins->emplace(entry.first, entry.second);
+            }
+        }
+    }
+    {
+        LOCK(cs_write_coins);
+        m_write_coins = coins;
+        m_write_block = hashBlock;
+    }
+    // The coins are only read by the writer thread (and by lookups) until the
+    // write completes; they are released in WaitForWriteLocked.
+    m_write_thread = std::thread(&TraceThread<std::function<void()>>, "coinsflush", std::function<void()>([this, coins, hashBlock, old_tip] {
+        m_write_result = false;
+        try {
+            m_write_result = WriteCoins(*coins, hashBlock, old_tip, false);
+        } catch (const std::exception& e) {
+            LogPrintf("Error writing coins in the background: %s\n", e.what());
+        }
+    }));
+    return true;
+}
+
+bool CCoinsViewDB::WaitForWrite() const
+{
+    LOCK(cs_writer);
+    return WaitForWriteLocked();
+}
+
+bool CCoinsViewDB::WaitForWriteLocked() const
+{
+    AssertLockHeld(cs_writer);
+    if (m_write_thread.joinable()) {
+        int64_t nStart = GetTimeMicros();
+        m_write_thread.join();
+        LogPrint(BCLog::BENCH, "Waited %.2fms for background coins write\n", (GetTimeMicros() - nStart) * 0.001);
+        m_write_ok &= m_write_result;
+        LOCK(cs_write_coins);
+        m_write_coins.reset();
+        m_write_block.SetNull();
+    }
+    return m_write_ok;
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap& mapCoins, const uint256& hashBlock, const uint256& old_tip, bool erase)
+{
+    CDBBatch batch(db);
+    size_t count = 0;
+    size_t changed = 0;
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+
     // In the first batch, mark the database as being in the middle of a
     // transition from old_tip to hashBlock.
     // A vector is used for future extensibility, as we may want to support
@@ -115,8 +200,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        // Entries written in the background must stay visible to lookups
+        // until the whole write is committed.
+        if (erase) {
+            it = mapCoins.erase(it);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -168,8 +258,24 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::WriteBlockIndexDumpTag(uint64_t tag) {
+    return Write(DB_BLOCK_INDEX_DUMP, tag, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexDumpTag(uint64_t& tag) {
+    return Read(DB_BLOCK_INDEX_DUMP, tag);
+}
+
+bool CBlockTreeDB::EraseBlockIndexDumpTag() {
+    return Erase(DB_BLOCK_INDEX_DUMP, true);
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Only iterate over a fully written database; holding cs_writer keeps a
+    // new background write from starting before the iterator is created.
+    LOCK(cs_writer);
+    WaitForWriteLocked();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
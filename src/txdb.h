@@ -10,10 +10,12 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -37,27 +39,72 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to the coinstats index DB specific cache (MiB)
+static const int64_t nMaxCoinStatsIndexCache = 8;
+//! Max memory allocated to the address index DB specific cache (MiB)
+static const int64_t nMaxAddressIndexCache = 1024;
+//! Max memory allocated to the spent-output index DB specific cache (MiB)
+static const int64_t nMaxSpentIndexCache = 1024;
+//! Max memory allocated to all block filter index DB caches combined (MiB)
+static const int64_t nMaxBlockFilterIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
-
-/** CCoinsView backed by the coin database (chainstate/) */
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
+
+/** CCoinsView backed by the coin database (chainstate/)
+ *
+ * With background writing enabled, BatchWrite takes ownership of the passed
+ * coins (or copies the modified ones, if they are not to be erased) and
+ * returns immediately, writing them from a separate thread. Until
+ * that write completes the coins are kept in memory and consulted before the
+ * database, so readers never observe a partially written state. A crash in
+ * the middle of a write is recovered from by ReplayBlocks, exactly like an
+ * interrupted synchronous write.
+ */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+private:
+    bool m_background_write = false;
+
+    //! Serializes starting and waiting for background writes.
+    mutable CCriticalSection cs_writer;
+    mutable std::thread m_write_thread GUARDED_BY(cs_writer);
+    mutable bool m_write_ok GUARDED_BY(cs_writer) = true;
+    //! Result of the last background write, set by the writer thread before it exits.
+    bool m_write_result = true;
+
+    //! Coins being written in the background, and the block they are for.
+    //! The writer thread holds its own reference to the coins, which are not
+    //! modified until both have let go of them.
+    mutable CCriticalSection cs_write_coins;
+    mutable std::shared_ptr<const CCoinsMap> m_write_coins GUARDED_BY(cs_write_coins);
+    mutable uint256 m_write_block GUARDED_BY(cs_write_coins);
+
+    bool WriteCoins(CCoinsMap& mapCoins, const uint256& hashBlock, const uint256& old_tip, bool erase);
+    bool WaitForWriteLocked() const EXCLUSIVE_LOCKS_REQUIRED(cs_writer);
 public:
-    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    //! name is the directory of the database, relative to the data directory
+    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& name = "chainstate");
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) override;
     CCoinsViewCursor *Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! Write future batches in the background (see above).
+    void SetBackgroundWrite(bool background) { m_background_write = background; }
+    //! Wait for a background write to complete. Returns false if any write failed.
+    bool WaitForWrite() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -95,6 +142,14 @@ public:
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /**
+     * The tag of the block index dump (see DumpBlockIndex), written once the
+     * dump is complete. It is erased when the block index is loaded, so that
+     * a dump is only used if the database did not change since.
+     */
+    bool WriteBlockIndexDumpTag(uint64_t tag);
+    bool ReadBlockIndexDumpTag(uint64_t& tag);
+    bool EraseBlockIndexDumpTag();
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
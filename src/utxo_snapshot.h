@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXO_SNAPSHOT_H
+#define BITCOIN_UTXO_SNAPSHOT_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <ios>
+#include <stdint.h>
+#include <string.h>
+
+//! Bytes a UTXO set snapshot file starts with
+static const unsigned char SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+/**
+ * Metadata at the start of a UTXO set snapshot file, as written by the
+ * dumptxoutset RPC and read by -loadtxoutset.
+ *
+ * It is followed by the headers of blocks 1 to m_base_height, so that a node
+ * without any chain can load the snapshot, and then by m_coins_count
+ * (COutPoint, Coin) pairs in the order of the coins database.
+ */
+class SnapshotMetadata
+{
+public:
+    static const uint16_t VERSION = 1;
+
+    //! The block the UTXO set is the state after
+    uint256 m_base_blockhash;
+    uint32_t m_base_height = 0;
+    uint64_t m_coins_count = 0;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s.write((const char*)SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        s << uint16_t{VERSION} << m_base_blockhash << m_base_height << m_coins_count;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+        uint16_t version;
+        s.read((char*)magic, sizeof(magic));
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            throw std::ios_base::failure("Not a UTXO set snapshot");
+        }
+        s >> version;
+        if (version != VERSION) {
+            throw std::ios_base::failure("Unsupported UTXO set snapshot version");
+        }
+        s >> m_base_blockhash >> m_base_height >> m_coins_count;
+    }
+};
+
+#endif // BITCOIN_UTXO_SNAPSHOT_H
@@ -6,10 +6,13 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockcache.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <compressor.h>
+#include <coinstats.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
@@ -17,12 +20,14 @@
 #include <cuckoocache.h>
 #include <hash.h>
 #include <index/txindex.h>
+#include <mappedfile.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
 #include <pow.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
+#include <pubkey.h>
 #include <random.h>
 #include <reverse_iterator.h>
 #include <script/script.h>
@@ -38,11 +43,15 @@
 #include <util.h>
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
+#include <utxo_snapshot.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <atomic>
+#include <deque>
 #include <future>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -89,6 +98,43 @@ enum DisconnectResult
 
 class ConnectTrace;
 
+std::shared_ptr<const CBlock> BlockReadAhead::ReadAndCheck(const CDiskBlockPos pos, const uint256 hash, const Consensus::Params& params)
+{
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*block, pos, params) || block->GetHash() != hash) {
+        return nullptr;
+    }
+    // Caches a successful result in block->fChecked, so that ConnectBlock does not redo the work.
+    CValidationState state;
+    CheckBlock(*block, state, params);
+    return block;
+}
+
+void BlockReadAhead::Start(const CBlockIndex* pindex, const Consensus::Params& params)
+{
+    AssertLockHeld(cs_main);
+    if (pindex == m_pindex) return;
+    Take(nullptr);
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) return;
+    m_pindex = pindex;
+    m_block = std::async(std::launch::async, &ReadAndCheck, pindex->GetBlockPos(), pindex->GetBlockHash(), std::cref(params));
+}
+
+std::shared_ptr<const CBlock> BlockReadAhead::Take(const CBlockIndex* pindex)
+{
+    if (!m_block.valid()) return nullptr;
+    std::shared_ptr<const CBlock> block;
+    try {
+        block = m_block.get();
+    } catch (const std::exception&) {
+        // Like a failed read; the regular code path reports the error.
+    }
+    bool match = pindex && pindex == m_pindex;
+    m_pindex = nullptr;
+    return match ? block : nullptr;
+}
+
+
 /**
  * CChainState stores and provides an API to update our local knowledge of the
  * current best chain and header tree.
@@ -150,6 +196,9 @@ private:
      */
     CCriticalSection m_cs_chainstate;
 
+    /** Pipelines block reads in ActivateBestChainStep. Protected by m_cs_chainstate. */
+    BlockReadAhead m_block_read_ahead;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -183,6 +232,8 @@ public:
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
     bool LoadGenesisBlock(const CChainParams& chainparams);
+    /** Load the coins of a UTXO set snapshot whose headers are already known. See LoadTxOutSetSnapshot. */
+    bool LoadSnapshot(CAutoFile& file, const SnapshotMetadata& metadata, const CChainParams& chainparams, CValidationState& state) LOCKS_EXCLUDED(cs_main);
 
     void PruneBlockIndexCandidates();
 
@@ -195,6 +246,8 @@ private:
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /** Load the block index from the dump written by DumpBlockIndex, if its tag matches. */
+    bool LoadBlockIndexDump(uint64_t tag, std::vector<std::pair<int, CBlockIndex*>>& vSortedByHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /**
      * Make various assertions about the state of the block index.
      *
@@ -221,6 +274,9 @@ CWaitableCriticalSection g_best_block_mutex;
 CConditionVariable g_best_block_cv;
 uint256 g_best_block;
 int nScriptCheckThreads = 0;
+int nSyncedScriptCheckThreads = DEFAULT_SYNCED_SCRIPTCHECK_THREADS;
+bool fPrefetchInputs = DEFAULT_PREFETCH_INPUTS;
+bool fCompressBlocks = DEFAULT_BLOCK_COMPRESSION;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
@@ -230,6 +286,7 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+BlockCache g_block_cache(DEFAULT_BLOCK_CACHE_SIZE << 20);
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -261,6 +318,9 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Block files mapped for reading blocks. Mapping uses a lot of address space, so only do it on 64-bit systems. */
+    MappedFileCache g_mapped_block_files(sizeof(void*) >= 8 ? MAX_MAPPED_BLOCK_FILES : 0,
+                                         [](int nFile) { return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"); });
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -308,7 +368,8 @@ enum class FlushStateMode {
 static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &state, FlushStateMode mode, int nManualPruneHeight=0);
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static int GetSnapshotValidatedHeight() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr, const PubKeyParseCache* pubkey_cache = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -1052,7 +1113,12 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
 // CBlock and CBlockIndex
 //
 
-static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+/**
+ * Write a block to disk. If compressed is not empty, it is the block in
+ * compressed form (see CBlockCompressor) and is written instead; the size in
+ * the index header then has BLOCKFILE_COMPRESSED_FLAG set.
+ */
+static bool WriteBlockToDisk(const CBlock& block, const std::vector<unsigned char>& compressed, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1060,7 +1126,7 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
+    unsigned int nSize = compressed.empty() ? GetSerializeSize(fileout, block) : (compressed.size() | BLOCKFILE_COMPRESSED_FLAG);
     fileout << messageStart << nSize;
 
     // Write block
@@ -1068,26 +1134,74 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (compressed.empty()) {
+        fileout << block;
+    } else {
+        fileout.write((const char*)compressed.data(), compressed.size());
+    }
 
     return true;
 }
 
+/** Read a block from a stream at its index header, which is 8 bytes before its position. */
+template <typename Stream>
+static void ReadBlockRecord(Stream& filein, CBlock& block)
+{
+    CMessageHeader::MessageStartChars blk_start;
+    unsigned int blk_size;
+    filein >> blk_start >> blk_size;
+    if (blk_size & BLOCKFILE_COMPRESSED_FLAG) {
+        filein >> CBlockCompressor(block);
+    } else {
+        filein >> block;
+    }
+}
+
+/**
+ * Get a mapping of the block file of pos, to read blocks from without system
+ * calls or copies. Returns null if the file cannot be mapped, or is the one
+ * blocks are appended to, which grows (and is truncated when finalized) while
+ * it would be mapped.
+ */
+static std::shared_ptr<const MappedFile> GetMappedBlockFile(const CDiskBlockPos& pos)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile) return nullptr;
+    }
+    return g_mapped_block_files.Get(pos.nFile);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    // Seek back 8 bytes for the index header, which tells how the block is stored
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= 8;
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    if (std::shared_ptr<const MappedFile> mapped = GetMappedBlockFile(hpos)) {
+        // Read block from the mapped file
+        try {
+            SpanReader filein(SER_DISK, CLIENT_VERSION, mapped->GetData(), hpos.nPos);
+            ReadBlockRecord(filein, block);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            ReadBlockRecord(filein, block);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1099,29 +1213,45 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDisk(pindex, consensusParams);
+    if (!pblock) {
+        return false;
+    }
+    block = *pblock;
+    // Like a block just read, the copy has not been checked yet.
+    block.fChecked = false;
+    return true;
+}
+
+std::shared_ptr<const CBlock> ReadBlockFromDisk(const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool cache_block)
+{
+    if (std::shared_ptr<const CBlock> cached = g_block_cache.Get(pindex->GetBlockHash())) {
+        return cached;
+    }
+
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
     CDiskBlockPos blockPos;
     {
         LOCK(cs_main);
         blockPos = pindex->GetBlockPos();
     }
 
-    if (!ReadBlockFromDisk(block, blockPos, consensusParams))
-        return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+    if (!ReadBlockFromDisk(*block, blockPos, consensusParams))
+        return nullptr;
+    if (block->GetHash() != pindex->GetBlockHash()) {
+        error("ReadBlockFromDisk(CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
-    return true;
+        return nullptr;
+    }
+    if (cache_block) {
+        g_block_cache.Insert(pindex->GetBlockHash(), block);
+    }
+    return block;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+template <typename Stream>
+static bool ReadRawBlock(Stream& filein, std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
-    CDiskBlockPos hpos = pos;
-    hpos.nPos -= 8; // Seek back 8 bytes for meta header
-    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
-    }
-
     try {
         CMessageHeader::MessageStartChars blk_start;
         unsigned int blk_size;
@@ -1134,9 +1264,18 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
                     HexStr(message_start, message_start + CMessageHeader::MESSAGE_START_SIZE));
         }
 
-        if (blk_size > MAX_SIZE) {
+        if ((blk_size & ~BLOCKFILE_COMPRESSED_FLAG) > MAX_SIZE) {
             return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
-                    blk_size, MAX_SIZE);
+                    blk_size & ~BLOCKFILE_COMPRESSED_FLAG, MAX_SIZE);
+        }
+
+        if (blk_size & BLOCKFILE_COMPRESSED_FLAG) {
+            // Peers get the block as it would be stored uncompressed
+            CBlock decompressed;
+            filein >> CBlockCompressor(decompressed);
+            block.clear();
+            CVectorWriter(SER_DISK, CLIENT_VERSION, block, 0) << decompressed;
+            return true;
         }
 
         block.resize(blk_size); // Zeroing of memory is intentional here
@@ -1148,6 +1287,27 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+{
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= 8; // Seek back 8 bytes for meta header
+
+    if (std::shared_ptr<const MappedFile> mapped = GetMappedBlockFile(hpos)) {
+        try {
+            SpanReader filein(SER_DISK, CLIENT_VERSION, mapped->GetData(), hpos.nPos);
+            return ReadRawBlock(filein, block, pos, message_start);
+        } catch (const std::exception& e) {
+            return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+    }
+    return ReadRawBlock(filein, block, pos, message_start);
+}
+
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
 {
     CDiskBlockPos block_pos;
@@ -1340,7 +1500,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
-    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
+    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata, m_pubkey_cache), &error);
 }
 
 int GetSpendHeight(const CCoinsViewCache& inputs)
@@ -1353,6 +1513,8 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
+//! Guards the lookups and insertions of scriptExecutionCache, which needs an external lock.
+static CWaitableCriticalSection cs_script_execution_cache;
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
@@ -1363,6 +1525,17 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+/** The script execution cache entry of a transaction checked with the given flags. */
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1377,7 +1550,7 @@ void InitScriptExecutionCache() {
  *
  * Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
  */
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks, const PubKeyParseCache* pubkey_cache)
 {
     if (!tx.IsCoinBase())
     {
@@ -1399,14 +1572,12 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // correct (ie that the transaction hash which is in tx's prevouts
             // properly commits to the scriptPubKey in the inputs view of that
             // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-            AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
-            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
-                return true;
+            uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
+            {
+                WaitableLock lock(cs_script_execution_cache); //TODO: Remove this requirement by making CuckooCache not require external locks
+                if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                    return true;
+                }
             }
 
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
@@ -1421,7 +1592,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 // spent being checked as a part of CScriptCheck.
 
                 // Verify signature
-                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore, &txdata, pubkey_cache);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1452,6 +1623,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
+                WaitableLock lock(cs_script_execution_cache);
                 scriptExecutionCache.insert(hashCacheEntry);
             }
         }
@@ -1489,7 +1661,9 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -1520,6 +1694,8 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1689,6 +1865,117 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+namespace {
+
+/** Result slot for a single prefetched coin, owned by the caller of PrefetchBlockInputs. */
+struct PrefetchedCoin
+{
+    Coin coin;
+    bool found = false;
+};
+
+/**
+ * Closure representing one coins database lookup performed ahead of
+ * ConnectBlock. Lookups never fail the queue: a read error simply leaves the
+ * coin to be fetched (and the error to be handled) by the regular code path.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* m_view;
+    COutPoint m_outpoint;
+    PrefetchedCoin* m_result;
+
+public:
+    CCoinsPrefetch() : m_view(nullptr), m_result(nullptr) {}
+    CCoinsPrefetch(const CCoinsView& view, const COutPoint& outpoint, PrefetchedCoin* result) :
+        m_view(&view), m_outpoint(outpoint), m_result(result) {}
+
+    bool operator()()
+    {
+        try {
+            m_result->found = m_view->GetCoin(m_outpoint, m_result->coin);
+        } catch (const std::exception&) {
+            m_result->found = false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(m_view, check.m_view);
+        std::swap(m_outpoint, check.m_outpoint);
+        std::swap(m_result, check.m_result);
+    }
+};
+
+} // namespace
+
+/**
+ * The number of worker threads of the script check and input prefetch queues
+ * to use: all of them during the initial block download, and the ones up to
+ * nSyncedScriptCheckThreads after it. Computed before taking the control of a
+ * queue, as it takes cs_main.
+ */
+static unsigned int GetCheckWorkerLimit()
+{
+    return (IsInitialBlockDownload() ? nScriptCheckThreads : nSyncedScriptCheckThreads) - 1;
+}
+
+// Database reads are latency-bound, so keep batches small to spread them over all workers.
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(16);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Warm cache with the coins spent by block. All inputs that are neither cached
+ * yet nor created earlier in the same block are read from db concurrently by
+ * the prefetch threads, instead of one at a time as ConnectBlock misses them.
+ *
+ * db must be the (possibly indirect) base view of cache, and nothing may be flushed to db while
+ * the reads are in flight: cs_main is held for the tip's views, and the background chainstate's
+ * views are only used by its own thread.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& db)
+{
+    if (!fPrefetchInputs || !nScriptCheckThreads) return;
+
+    std::unordered_set<uint256, SaltedTxidHasher> block_txids;
+    block_txids.reserve(block.vtx.size());
+    std::vector<COutPoint> outpoints;
+    for (const auto& tx : block.vtx) {
+        if (!tx->IsCoinBase()) {
+            for (const CTxIn& txin : tx->vin) {
+                if (block_txids.count(txin.prevout.hash) || cache.HaveCoinInCache(txin.prevout)) continue;
+                outpoints.push_back(txin.prevout);
+            }
+        }
+        block_txids.insert(tx->GetHash());
+    }
+    if (outpoints.empty()) return;
+
+    std::vector<PrefetchedCoin> results(outpoints.size());
+    std::vector<CCoinsPrefetch> vChecks;
+    vChecks.reserve(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        vChecks.emplace_back(db, outpoints[i], &results[i]);
+    }
+    const unsigned int nWorkerLimit = GetCheckWorkerLimit();
+    CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+    control.SetWorkerLimit(nWorkerLimit);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        if (results[i].found) {
+            cache.EmplaceCoinFromBase(outpoints[i], std::move(results[i].coin));
+        }
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1790,22 +2077,25 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 
 
-static int64_t nTimeCheck = 0;
-static int64_t nTimeForks = 0;
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
+static std::atomic<int64_t> nTimeCheck{0};
+static std::atomic<int64_t> nTimeForks{0};
+static std::atomic<int64_t> nTimeVerify{0};
+static std::atomic<int64_t> nTimeParsePubKeys{0};
+static std::atomic<int64_t> nTimeConnect{0};
+static std::atomic<int64_t> nTimeIndex{0};
+static std::atomic<int64_t> nTimeCallbacks{0};
 static int64_t nTimeTotal = 0;
-static int64_t nBlocksTotal = 0;
+static std::atomic<int64_t> nBlocksTotal{0};
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  cs_main is only taken for the parts that use the block index and the
+ *  version bits cache, so a caller with a view of its own (the background
+ *  chainstate) need not hold it; the ancestors of pindex do not change. */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                   CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
 {
-    AssertLockHeld(cs_main);
     assert(pindex);
     assert(*pindex->phashBlock == block.GetHash());
     int64_t nTimeStart = GetTimeMicros();
@@ -1849,6 +2139,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     bool fScriptChecks = true;
     if (!hashAssumeValid.IsNull()) {
+        LOCK(cs_main);
         // We've been configured with the hash of a block which has been externally verified to have a valid history.
         // A suitable default value is included with the software and updated from time to time.  Because validity
         //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
@@ -1968,19 +2259,39 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == ThresholdState::ACTIVE) {
-        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
+    unsigned int flags;
+    {
+        LOCK(cs_main);
+        if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == ThresholdState::ACTIVE) {
+            nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
+        }
 
-    // Get the script flags for this block
-    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
+        // Get the script flags for this block
+        flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
+    }
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    // Parse the public keys used more than once in the block up front, to
+    // share them between its signature checks. This must outlive control.
+    PubKeyParseCache pubkey_cache;
+    if (fScriptChecks) {
+        // Transactions whose scripts were already checked, typically when
+        // they entered the mempool, skip their signature checks altogether.
+        ParseBlockPubKeys(block, pubkey_cache, [flags](const CTransaction& tx) {
+            WaitableLock lock(cs_script_execution_cache);
+            return scriptExecutionCache.contains(GetScriptExecutionCacheEntry(tx, flags), false);
+        });
+    }
+    int64_t nTime2b = GetTimeMicros(); nTimeParsePubKeys += nTime2b - nTime2;
+    LogPrint(BCLog::BENCH, "      - Parse %u reused public keys: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)pubkey_cache.size(), MILLI * (nTime2b - nTime2), nTimeParsePubKeys * MICRO, nTimeParsePubKeys * MILLI / nBlocksTotal);
+
+    const unsigned int nWorkerLimit = GetCheckWorkerLimit();
+    auto control = MakeUnique<CCheckQueueControl<CScriptCheck>>(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    control->SetWorkerLimit(nWorkerLimit);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
@@ -2030,15 +2341,17 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
 
-        txdata.emplace_back(tx);
+        // Below the assumed-valid block no scripts are checked, so the legacy
+        // signature hash midstates would go unused.
+        txdata.emplace_back(tx, fScriptChecks);
         if (!tx.IsCoinBase())
         {
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr, &pubkey_cache))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
-            control.Add(vChecks);
+            control->Add(vChecks);
         }
 
         CTxUndo undoDummy;
@@ -2047,8 +2360,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2b;
+    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2b), MILLI * (nTime3 - nTime2b) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2b) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0]->GetValueOut() > blockReward)
@@ -2057,20 +2370,27 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    if (!control->Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
+    // Give up the script check queue before taking cs_main below: the tip is
+    // validated with cs_main held, and waits for the queue while holding it.
+    control.reset();
+
     if (fJustCheck)
         return true;
 
-    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
-        return false;
+    {
+        LOCK(cs_main);
+        if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
+            return false;
 
-    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
-        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
-        setDirtyBlockIndex.insert(pindex);
+        if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            setDirtyBlockIndex.insert(pindex);
+        }
     }
 
     assert(pindex->phashBlock);
@@ -2145,7 +2465,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
-            // Depend on nMinDiskSpace to ensure we can write block index
+            // Depend on the minimum free disk space to ensure we can write block index
             if (!CheckDiskSpace(0, true))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
@@ -2168,9 +2488,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files. A background chainstate write
+            // may still need them to be replayed after a crash.
+            if (fFlushForPrune) {
+                if (!pcoinsdbview->WaitForWrite())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2183,7 +2507,16 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // With -backgroundflush this only waits for the previous write to
+            // complete, unless the caller needs the state to be on disk.
+            if (!pcoinsTip->Sync())
+                return AbortNode(state, "Failed to write to coin database");
+            // All coins are now unmodified. If the cache is over its limit,
+            // keep the recently used ones to preserve the hit rate.
+            if (fCacheLarge || fCacheCritical) {
+                pcoinsTip->Trim(nTotalSpace / 100 * COINS_CACHE_RETAIN_PERCENT);
+            }
+            if ((mode == FlushStateMode::ALWAYS || fFlushForPrune) && !pcoinsdbview->WaitForWrite())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
             full_flush_completed = true;
@@ -2346,6 +2679,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2429,10 +2763,9 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
     if (!pblock) {
-        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
-        if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
+        pthisBlock = ReadBlockFromDisk(pindexNew, chainparams.GetConsensus());
+        if (!pthisBlock)
             return AbortNode(state, "Failed to read block");
-        pthisBlock = pblockNew;
     } else {
         pthisBlock = pblock;
     }
@@ -2441,6 +2774,9 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    PrefetchBlockInputs(blockConnecting, *pcoinsTip, *pcoinsdbview);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetched - nTime2) * MILLI, nTimePrefetch * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2450,8 +2786,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
                 InvalidBlockFound(pindexNew, state);
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
-        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTimePrefetched;
+        LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTimePrefetched) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
     }
@@ -2462,6 +2798,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime5 - nTime4) * MILLI, nTimeChainState * MICRO, nTimeChainState * MILLI / nBlocksTotal);
+    // The new tip is the block most likely to be asked for next.
+    g_block_cache.Insert(pindexNew->GetBlockHash(), pthisBlock);
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     disconnectpool.removeForBlock(blockConnecting.vtx);
@@ -2590,7 +2928,15 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
 
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork ? pblock : m_block_read_ahead.Take(pindexConnect);
+            // Read the following block while this one is being connected.
+            if (pindexConnect != pindexMostWork) {
+                CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if (pindexNext != pindexMostWork || !pblock) {
+                    m_block_read_ahead.Start(pindexNext, chainparams.GetConsensus());
+                }
+            }
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible()) {
@@ -2916,13 +3262,11 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = mapBlockIndex.emplace(hash, block).first->second;
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
@@ -3436,6 +3780,18 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
 /** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
 static CDiskBlockPos SaveBlockToDisk(const CBlock& block, int nHeight, const CChainParams& chainparams, const CDiskBlockPos* dbp) {
     unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    std::vector<unsigned char> compressed;
+    if (dbp == nullptr && fCompressBlocks && IsBlockCompressible(block)) {
+        CVectorWriter(SER_DISK, CLIENT_VERSION, compressed, 0) << CBlockCompressor(REF(block));
+        if (compressed.size() < nBlockSize) {
+            nBlockSize = compressed.size();
+        } else {
+            compressed.clear();
+        }
+    }
+    // Blocks that are already on disk are accounted for at their uncompressed
+    // size, as how they are stored is not known here. At worst, that leaves
+    // some unused space after the last one.
     CDiskBlockPos blockPos;
     if (dbp != nullptr)
         blockPos = *dbp;
@@ -3444,7 +3800,7 @@ static CDiskBlockPos SaveBlockToDisk(const CBlock& block, int nHeight, const CCh
         return CDiskBlockPos();
     }
     if (dbp == nullptr) {
-        if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart())) {
+        if (!WriteBlockToDisk(block, compressed, blockPos, chainparams.MessageStart())) {
             AbortNode("Failed to write block");
             return CDiskBlockPos();
         }
@@ -3645,6 +4001,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_mapped_block_files.Erase(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3662,6 +4019,11 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 
     // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
     unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
+    // and background validation of a UTXO set snapshot must have connected it
+    const int nSnapshotValidatedHeight = GetSnapshotValidatedHeight();
+    if (nSnapshotValidatedHeight < 0)
+        return;
+    nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, (unsigned)nSnapshotValidatedHeight);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
         if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
@@ -3709,6 +4071,13 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
     }
 
     unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    // Background validation of a UTXO set snapshot still needs the blocks it
+    // has not connected yet.
+    const int nSnapshotValidatedHeight = GetSnapshotValidatedHeight();
+    if (nSnapshotValidatedHeight < 0) {
+        return;
+    }
+    nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, (unsigned)nSnapshotValidatedHeight);
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -3756,10 +4125,7 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
 
 bool CheckDiskSpace(uint64_t nAdditionalBytes, bool blocks_dir)
 {
-    uint64_t nFreeBytesAvailable = fs::space(blocks_dir ? GetBlocksDir() : GetDataDir()).available;
-
-    // Check for nMinDiskSpace bytes (currently 50MB)
-    if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
+    if (!CheckDiskSpace(blocks_dir ? GetBlocksDir() : GetDataDir(), nAdditionalBytes))
         return AbortNode("Disk space is low!", _("Error: Disk space is low!"));
 
     return true;
@@ -3809,39 +4175,123 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     if (hash.IsNull())
         return nullptr;
 
-    // Return existing
-    BlockMap::iterator mi = mapBlockIndex.find(hash);
-    if (mi != mapBlockIndex.end())
-        return (*mi).second;
+    // Return existing or create new
+    return mapBlockIndex.emplace(hash).first->second;
+}
 
-    // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+static const uint64_t BLOCK_INDEX_DUMP_VERSION = 1;
 
-    return pindexNew;
+bool CChainState::LoadBlockIndexDump(uint64_t tag, std::vector<std::pair<int, CBlockIndex*>>& vSortedByHeight)
+{
+    std::unique_ptr<MappedFile> mapped = MappedFile::Open(GetDataDir() / "blockindex.dat");
+    if (!mapped) {
+        LogPrintf("Failed to open block index dump. Loading the block index from the database.\n");
+        return false;
+    }
+
+    try {
+        SpanReader stream(SER_DISK, CLIENT_VERSION, mapped->GetData(), 0);
+        uint64_t version, dump_tag, count;
+        stream >> version >> dump_tag >> count;
+        if (version != BLOCK_INDEX_DUMP_VERSION || dump_tag != tag) {
+            LogPrintf("Block index dump does not match the database. Loading the block index from the database.\n");
+            return false;
+        }
+
+        // The entries are sorted by height, and refer to their ancestors by
+        // position. They were checked before they were written, so the proof
+        // of work is not checked and the block hashes are not recomputed.
+        mapBlockIndex.reserve(count);
+        vSortedByHeight.reserve(count);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t prev, skip;
+            uint256 hash;
+            stream >> VARINT(prev) >> VARINT(skip) >> hash;
+            if (prev > i || skip > i || mapBlockIndex.count(hash)) {
+                throw std::ios_base::failure("invalid block index entry");
+            }
+            CBlockIndex* pindexNew = InsertBlockIndex(hash);
+            pindexNew->pprev = prev ? vSortedByHeight[prev - 1].second : nullptr;
+            pindexNew->pskip = skip ? vSortedByHeight[skip - 1].second : nullptr;
+            stream >> VARINT(pindexNew->nHeight, VarIntMode::NONNEGATIVE_SIGNED);
+            stream >> VARINT(pindexNew->nStatus);
+            stream >> VARINT(pindexNew->nTx);
+            stream >> VARINT(pindexNew->nFile, VarIntMode::NONNEGATIVE_SIGNED);
+            stream >> VARINT(pindexNew->nDataPos);
+            stream >> VARINT(pindexNew->nUndoPos);
+            stream >> pindexNew->nVersion;
+            stream >> pindexNew->hashMerkleRoot;
+            stream >> pindexNew->nTime;
+            stream >> pindexNew->nBits;
+            stream >> pindexNew->nNonce;
+            vSortedByHeight.push_back(std::make_pair(pindexNew->nHeight, pindexNew));
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize block index dump: %s. Loading the block index from the database.\n", e.what());
+        mapBlockIndex.clear();
+        vSortedByHeight.clear();
+        return false;
+    }
+    return true;
 }
 
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
-        return false;
+    int64_t nTimeStart = GetTimeMicros();
 
-    boost::this_thread::interruption_point();
+    // A dump of the block index is only valid until the database changes, so
+    // forget about it whether it is used or not.
+    uint64_t dump_tag;
+    bool fHaveDump = blocktree.ReadBlockIndexDumpTag(dump_tag);
+    if (fHaveDump && !blocktree.EraseBlockIndexDumpTag()) {
+        return error("%s: failed to erase the block index dump tag", __func__);
+    }
 
-    // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+    bool fFromDump = fHaveDump && gArgs.GetBoolArg("-persistblockindex", DEFAULT_PERSIST_BLOCK_INDEX) && LoadBlockIndexDump(dump_tag, vSortedByHeight);
+    if (!fFromDump) {
+        if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+            return false;
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        for (const auto& item : mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    }
+    int64_t nTime1 = GetTimeMicros();
+    LogPrint(BCLog::BENCH, "    - Load block index entries: %.2fms\n", MILLI * (nTime1 - nTimeStart));
+
+    boost::this_thread::interruption_point();
+
+    // The proof of each block only depends on its own header, so compute
+    // them in parallel, and leave the sums along the chains to the loop below.
+    const size_t nThreads = std::max(1, nScriptCheckThreads);
+    const size_t nChunkSize = (vSortedByHeight.size() + nThreads - 1) / nThreads;
+    auto compute_proofs = [&vSortedByHeight](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            CBlockIndex* pindex = vSortedByHeight[i].second;
+            pindex->nChainWork = GetBlockProof(*pindex);
+        }
+    };
+    std::vector<std::future<void>> vProofWorkers;
+    for (size_t begin = nChunkSize; begin < vSortedByHeight.size(); begin += nChunkSize) {
+        vProofWorkers.push_back(std::async(std::launch::async, compute_proofs, begin, std::min(begin + nChunkSize, vSortedByHeight.size())));
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    compute_proofs(0, std::min(nChunkSize, vSortedByHeight.size()));
+    for (std::future<void>& worker : vProofWorkers) {
+        worker.get();
+    }
+    int64_t nTime2 = GetTimeMicros();
+    LogPrint(BCLog::BENCH, "    - Compute block proofs: %.2fms\n", MILLI * (nTime2 - nTime1));
+
+    // Calculate nChainWork
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (pindex->pprev) pindex->nChainWork += pindex->pprev->nChainWork;
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -3865,11 +4315,15 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        // Skip pointers are stored in the dump.
+        if (pindex->pprev && !pindex->pskip)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTime3 = GetTimeMicros();
+    LogPrint(BCLog::BENCH, "    - Link block index entries: %.2fms\n", MILLI * (nTime3 - nTime2));
+    LogPrintf("%s: loaded %u block index entries from the %s in %.2fms\n", __func__, vSortedByHeight.size(), fFromDump ? "dump" : "database", MILLI * (nTime3 - nTimeStart));
 
     return true;
 }
@@ -3899,7 +4353,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     std::set<int> setBlkDataFiles;
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const auto& item : mapBlockIndex)
     {
         CBlockIndex* pindex = item.second;
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -3960,50 +4414,495 @@ bool LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
-CVerifyDB::CVerifyDB()
-{
-    uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
-}
+namespace {
 
-CVerifyDB::~CVerifyDB()
+/** Iterates over the coins of a UTXO set snapshot, reading them from the file as it goes. */
+class SnapshotCoinsCursor : public CCoinsViewCursor
 {
-    uiInterface.ShowProgress("", 100, false);
-}
+public:
+    SnapshotCoinsCursor(CAutoFile& file, const SnapshotMetadata& metadata) : CCoinsViewCursor(metadata.m_base_blockhash), m_file(file), m_remaining(metadata.m_coins_count)
+    {
+        Next();
+    }
 
-bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
-{
-    LOCK(cs_main);
-    if (chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr)
+    bool GetKey(COutPoint& key) const override
+    {
+        if (!m_valid) return false;
+        key = m_key;
         return true;
+    }
 
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
-    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
-    CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindex;
-    CBlockIndex* pindexFailure = nullptr;
-    int nGoodTransactions = 0;
-    CValidationState state;
-    int reportDone = 0;
-    LogPrintf("[0%%]..."); /* Continued */
-    for (pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
-        boost::this_thread::interruption_point();
-        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone); /* Continued */
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
-        if (pindex->nHeight <= chainActive.Height()-nCheckDepth)
+    bool GetValue(Coin& coin) const override
+    {
+        if (!m_valid) return false;
+        coin = m_coin;
+        return true;
+    }
+
+    unsigned int GetValueSize() const override { return ::GetSerializeSize(m_coin, SER_DISK, CLIENT_VERSION); }
+
+    bool Valid() const override { return m_valid; }
+
+    //! Throws std::ios_base::failure if the file is truncated.
+    void Next() override
+    {
+        m_valid = m_remaining > 0;
+        if (m_valid) {
+            --m_remaining;
+            m_file >> m_key >> m_coin;
+        }
+    }
+
+private:
+    CAutoFile& m_file;
+    uint64_t m_remaining;
+    COutPoint m_key;
+    Coin m_coin;
+    bool m_valid = false;
+};
+
+} // namespace
+
+bool LoadTxOutSetSnapshot(CAutoFile& file, const CChainParams& chainparams, CValidationState& state)
+{
+    SnapshotMetadata metadata;
+    try {
+        file >> metadata;
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Unable to read UTXO set snapshot: %s", e.what()));
+    }
+
+    bool genesis_connected;
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() > 0) {
+            const CBlockIndex* base = LookupBlockIndex(metadata.m_base_blockhash);
+            if (base && chainActive.Contains(base)) {
+                LogPrintf("UTXO set snapshot for block %s was already loaded\n", metadata.m_base_blockhash.ToString());
+                return true;
+            }
+            return state.Error("Unable to load a UTXO set snapshot on top of an existing chainstate");
+        }
+        genesis_connected = chainActive.Tip() != nullptr;
+    }
+    // Connect the genesis block first, as with a fresh chainstate.
+    if (!genesis_connected && !ActivateBestChain(state, chainparams)) {
+        return false;
+    }
+
+    // Accept the headers up to the snapshot's base first, so that the base
+    // block is known before any coins are loaded.
+    LogPrintf("Loading %u headers from UTXO set snapshot\n", metadata.m_base_height);
+    try {
+        std::vector<CBlockHeader> headers;
+        for (uint32_t height = 1; height <= metadata.m_base_height; ++height) {
+            headers.emplace_back();
+            file >> headers.back();
+            if (headers.size() == MAX_HEADERS_RESULTS || height == metadata.m_base_height) {
+                if (!ProcessNewBlockHeaders(headers, state, chainparams)) {
+                    return false;
+                }
+                headers.clear();
+            }
+        }
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Unable to read UTXO set snapshot headers: %s", e.what()));
+    }
+
+    return g_chainstate.LoadSnapshot(file, metadata, chainparams, state);
+}
+
+bool CChainState::LoadSnapshot(CAutoFile& file, const SnapshotMetadata& metadata, const CChainParams& chainparams, CValidationState& state)
+{
+    LOCK(m_cs_chainstate);
+    LOCK(cs_main);
+
+    CBlockIndex* base = LookupBlockIndex(metadata.m_base_blockhash);
+    if (!base || base->nHeight != (int)metadata.m_base_height) {
+        return state.Error("UTXO set snapshot base block does not match its headers");
+    }
+    const auto au = chainparams.Assumeutxo().find(base->nHeight);
+    if (au == chainparams.Assumeutxo().end()) {
+        return state.Error(strprintf("No assumeutxo data for UTXO set snapshot height %d", base->nHeight));
+    }
+
+    // First pass: check the coins hash to the expected value, without loading them.
+    const long coins_pos = ftell(file.Get());
+    CCoinsStats stats;
+    try {
+        SnapshotCoinsCursor cursor(file, metadata);
+        if (!GetUTXOStats(cursor, stats)) {
+            return state.Error("Unable to read UTXO set snapshot coins");
+        }
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Unable to read UTXO set snapshot coins: %s", e.what()));
+    }
+    if (stats.hashSerialized != au->second.hash_serialized || stats.nTransactionOutputs != metadata.m_coins_count) {
+        return state.Invalid(false, REJECT_INVALID, "bad-snapshot-hash",
+                             strprintf("UTXO set snapshot hash %s does not match the expected %s", stats.hashSerialized.ToString(), au->second.hash_serialized.ToString()));
+    }
+    if (coins_pos < 0 || fseek(file.Get(), coins_pos, SEEK_SET) != 0) {
+        return state.Error("Unable to rewind UTXO set snapshot");
+    }
+
+    // Second pass: load the coins. The chainstate is flushed whenever the cache
+    // is full, so mark it as incomplete until the block index is updated too.
+    LogPrintf("Loading %u coins from UTXO set snapshot at height %d\n", metadata.m_coins_count, base->nHeight);
+    pblocktree->WriteFlag("loadingtxoutset", true);
+    pcoinsTip->SetBestBlock(base->GetBlockHash());
+    try {
+        SnapshotCoinsCursor cursor(file, metadata);
+        uint64_t coins_loaded = 0;
+        for (; cursor.Valid(); cursor.Next()) {
+            COutPoint outpoint;
+            Coin coin;
+            cursor.GetKey(outpoint);
+            cursor.GetValue(coin);
+            pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+            if (++coins_loaded % 8192 == 0 && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
+                if (!pcoinsTip->Flush()) {
+                    return AbortNode(state, "Failed to write to coin database");
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Unable to load UTXO set snapshot coins: %s", e.what()));
+    }
+
+    // The blocks leading to the base are taken as valid without their data.
+    // nTx is unknown for them, so give every block one transaction and the
+    // base whatever makes up the total from the assumeutxo data.
+    std::vector<CBlockIndex*> history;
+    for (CBlockIndex* pindex = base; pindex->pprev; pindex = pindex->pprev) {
+        history.push_back(pindex);
+    }
+    std::reverse(history.begin(), history.end());
+    for (CBlockIndex* pindex : history) {
+        if (pindex->nTx == 0) {
+            pindex->nTx = 1;
+            if (pindex == base && au->second.nChainTx > pindex->pprev->nChainTx) {
+                pindex->nTx = au->second.nChainTx - pindex->pprev->nChainTx;
+            }
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->nStatus |= BLOCK_ASSUMED_VALID;
+        if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    // Blocks we already have the data for may now be linked.
+    std::deque<CBlockIndex*> queue(history.begin(), history.end());
+    while (!queue.empty()) {
+        CBlockIndex* pindex = queue.front();
+        queue.pop_front();
+        auto range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            CBlockIndex* child = range.first->second;
+            if (child->nChainTx == 0) {
+                child->nChainTx = pindex->nChainTx + child->nTx;
+                {
+                    LOCK(cs_nBlockSequenceId);
+                    child->nSequenceId = nBlockSequenceId++;
+                }
+                queue.push_back(child);
+            }
+            range.first = mapBlocksUnlinked.erase(range.first);
+        }
+    }
+
+    chainActive.SetTip(base);
+    for (const auto& entry : mapBlockIndex) {
+        CBlockIndex* pindex = entry.second;
+        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && pindex->nChainTx && !setBlockIndexCandidates.value_comp()(pindex, base)) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+    }
+    PruneBlockIndexCandidates();
+    UpdateTip(base, chainparams);
+
+    if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) {
+        return false;
+    }
+    pblocktree->WriteFlag("loadingtxoutset", false);
+    LogPrintf("Loaded UTXO set snapshot: %u coins at height %d, hash %s\n", metadata.m_coins_count, base->nHeight, stats.hashSerialized.ToString());
+
+    CheckBlockIndex(chainparams.GetConsensus());
+    return true;
+}
+
+namespace {
+
+//! Directory of the background coins database, relative to the data directory
+const char* const BACKGROUND_CHAINSTATE_DB_NAME = "chainstate_background";
+
+/**
+ * A second chainstate, validating the blocks a loaded UTXO set snapshot
+ * assumed valid. It shares the block index and ConnectBlock with g_chainstate,
+ * but connects the blocks from genesis up to the snapshot base onto a chain and
+ * coins database of its own, with a separate cache budget, so that the tip
+ * keeps being served while history is verified.
+ */
+class CBackgroundChainstate
+{
+public:
+    CBackgroundChainstate(CBlockIndex* base, size_t coins_db_cache, size_t coins_cache) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    //! The last block connected so far
+    CChain m_chain GUARDED_BY(cs_main);
+    //! The snapshot base, which the UTXO set is checked at
+    CBlockIndex* const m_base;
+
+    /** Connect blocks up to m_base as their data arrives, then check the UTXO set. */
+    void Run(const CChainParams& chainparams);
+
+private:
+    std::unique_ptr<CCoinsViewDB> m_coins_db;
+    std::unique_ptr<CCoinsViewCache> m_coins;
+    const size_t m_coins_cache;
+
+    bool Complete(const CChainParams& chainparams);
+};
+
+CBackgroundChainstate::CBackgroundChainstate(CBlockIndex* base, size_t coins_db_cache, size_t coins_cache) :
+    m_base(base), m_coins_db(MakeUnique<CCoinsViewDB>(coins_db_cache, false, false, BACKGROUND_CHAINSTATE_DB_NAME)), m_coins_cache(coins_cache)
+{
+    m_coins = MakeUnique<CCoinsViewCache>(m_coins_db.get());
+    // Resume where a previous run stopped.
+    const uint256 best_block = m_coins->GetBestBlock();
+    if (!best_block.IsNull()) {
+        CBlockIndex* pindex = LookupBlockIndex(best_block);
+        if (pindex && m_base->GetAncestor(pindex->nHeight) == pindex) {
+            m_chain.SetTip(pindex);
+        } else {
+            LogPrintf("Background validation: discarding coins at unknown block %s\n", best_block.ToString());
+            m_coins.reset();
+            m_coins_db.reset();
+            m_coins_db = MakeUnique<CCoinsViewDB>(coins_db_cache, false, true, BACKGROUND_CHAINSTATE_DB_NAME);
+            m_coins = MakeUnique<CCoinsViewCache>(m_coins_db.get());
+        }
+    }
+}
+
+void CBackgroundChainstate::Run(const CChainParams& chainparams)
+{
+    {
+        LOCK(cs_main);
+        LogPrintf("Background validation: validating blocks %d to %d, assumed valid by the UTXO set snapshot\n", m_chain.Height() + 1, m_base->nHeight);
+    }
+    while (true) {
+        CBlockIndex* pindex;
+        bool have_data;
+        {
+            LOCK(cs_main);
+            if (m_chain.Tip() == m_base) break;
+            pindex = m_base->GetAncestor(m_chain.Height() + 1);
+            have_data = pindex->nStatus & BLOCK_HAVE_DATA;
+        }
+        if (!have_data) {
+            // Wait for the block to be downloaded.
+            MilliSleep(100);
+            continue;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+            AbortNode(strprintf("Failed to read block %s for background validation", pindex->GetBlockHash().ToString()));
+            return;
+        }
+        // The coins are only used by this thread, so the block is connected
+        // without holding cs_main; ConnectBlock only takes it briefly, and the
+        // tip keeps being validated meanwhile.
+        CValidationState state;
+        PrefetchBlockInputs(block, *m_coins, *m_coins_db);
+        if (!g_chainstate.ConnectBlock(block, state, pindex, *m_coins, chainparams)) {
+            AbortNode(strprintf("Block %s at height %d, assumed valid by the UTXO set snapshot, failed validation: %s",
+                pindex->GetBlockHash().ToString(), pindex->nHeight, FormatStateMessage(state)));
+            return;
+        }
+        {
+            LOCK(cs_main);
+            m_chain.SetTip(pindex);
+        }
+        if (m_coins->DynamicMemoryUsage() > m_coins_cache && !m_coins->Flush()) {
+            AbortNode("Failed to write to background coin database");
+            return;
+        }
+        if (pindex->nHeight > 0 && pindex->nHeight % 10000 == 0) {
+            LogPrintf("Background validation: height=%d progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainparams.TxData(), pindex));
+        }
+        boost::this_thread::interruption_point();
+    }
+    if (Complete(chainparams)) {
+        m_coins.reset();
+        m_coins_db.reset();
+        fs::remove_all(GetDataDir() / BACKGROUND_CHAINSTATE_DB_NAME);
+    }
+}
+
+bool CBackgroundChainstate::Complete(const CChainParams& chainparams)
+{
+    if (!m_coins->Flush() || !m_coins_db->WaitForWrite()) {
+        return AbortNode("Failed to write to background coin database");
+    }
+    CCoinsStats stats;
+    if (!GetUTXOStats(m_coins_db.get(), stats)) {
+        return AbortNode("Failed to read background coin database");
+    }
+    const auto au = chainparams.Assumeutxo().find(m_base->nHeight);
+    if (au == chainparams.Assumeutxo().end() || stats.hashSerialized != au->second.hash_serialized) {
+        return AbortNode(strprintf("The UTXO set snapshot at height %d does not match the validated chain (UTXO set hash %s)",
+            m_base->nHeight, stats.hashSerialized.ToString()), _("The loaded UTXO set snapshot is invalid. Restart with -reindex to validate the chain from scratch."));
+    }
+
+    {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex = m_base; pindex; pindex = pindex->pprev) {
+            if (pindex->nStatus & BLOCK_ASSUMED_VALID) {
+                pindex->nStatus &= ~BLOCK_ASSUMED_VALID;
+                setDirtyBlockIndex.insert(pindex);
+            }
+        }
+        // The blocks' real transaction counts are known now.
+        for (int height = 1; height <= chainActive.Height(); ++height) {
+            chainActive[height]->nChainTx = chainActive[height - 1]->nChainTx + chainActive[height]->nTx;
+        }
+    }
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) {
+        return false;
+    }
+    LogPrintf("Background validation: validated the UTXO set snapshot at height %d\n", m_base->nHeight);
+    return true;
+}
+
+std::unique_ptr<CBackgroundChainstate> g_background_chainstate GUARDED_BY(cs_main);
+
+//! The last block of the active chain assumed valid by a UTXO set snapshot, if any.
+CBlockIndex* FindSnapshotBase() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    // The assumed valid blocks are a prefix of the active chain (after genesis).
+    if (chainActive.Height() < 1 || !(chainActive[1]->nStatus & BLOCK_ASSUMED_VALID)) return nullptr;
+    int low = 1, high = chainActive.Height();
+    while (low < high) {
+        const int mid = low + (high - low + 1) / 2;
+        if (chainActive[mid]->nStatus & BLOCK_ASSUMED_VALID) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return chainActive[low];
+}
+
+} // namespace
+
+bool IsSnapshotValidationPending()
+{
+    LOCK(cs_main);
+    return FindSnapshotBase() != nullptr;
+}
+
+/**
+ * The height of the last block background validation of a UTXO set snapshot
+ * has connected, which is -1 until it has started. Without a snapshot to
+ * validate, no block is needed anymore.
+ */
+static int GetSnapshotValidatedHeight()
+{
+    AssertLockHeld(cs_main);
+    if (!FindSnapshotBase()) return std::numeric_limits<int>::max();
+    if (!g_background_chainstate) return -1;
+    return g_background_chainstate->m_chain.Height();
+}
+
+void ThreadValidateSnapshot(size_t coins_db_cache, size_t coins_cache)
+{
+    // Mark the thread as CPU-bound, like the import thread. It is not given
+    // idle priority, as it takes cs_main and the script check queue that the
+    // tip is validated with.
+    ScheduleBatchPriority();
+
+    CBackgroundChainstate* chainstate;
+    {
+        LOCK(cs_main);
+        CBlockIndex* base = FindSnapshotBase();
+        if (!base) return;
+        g_background_chainstate = MakeUnique<CBackgroundChainstate>(base, coins_db_cache, coins_cache);
+        chainstate = g_background_chainstate.get();
+    }
+    try {
+        chainstate->Run(Params());
+    } catch (...) {
+        LOCK(cs_main);
+        g_background_chainstate.reset();
+        throw;
+    }
+    LOCK(cs_main);
+    g_background_chainstate.reset();
+}
+
+bool GetBackgroundValidationRange(const CBlockIndex*& from, const CBlockIndex*& target)
+{
+    AssertLockHeld(cs_main);
+    if (!g_background_chainstate || g_background_chainstate->m_chain.Tip() == g_background_chainstate->m_base) return false;
+    from = g_background_chainstate->m_chain.Tip() ? g_background_chainstate->m_chain.Tip() : chainActive.Genesis();
+    target = g_background_chainstate->m_base;
+    return true;
+}
+
+CVerifyDB::CVerifyDB()
+{
+    uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
+}
+
+CVerifyDB::~CVerifyDB()
+{
+    uiInterface.ShowProgress("", 100, false);
+}
+
+bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr)
+        return true;
+
+    // Verify blocks in the best chain
+    if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
+        nCheckDepth = chainActive.Height();
+    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    CCoinsViewCache coins(coinsview);
+    CBlockIndex* pindex;
+    CBlockIndex* pindexFailure = nullptr;
+    int nGoodTransactions = 0;
+    CValidationState state;
+    int reportDone = 0;
+    LogPrintf("[0%%]..."); /* Continued */
+    for (pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
+        boost::this_thread::interruption_point();
+        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
+        if (reportDone < percentageDone/10) {
+            // report every 10% step
+            LogPrintf("[%d%%]...", percentageDone); /* Continued */
+            reportDone = percentageDone/10;
+        }
+        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
+        if (pindex->nHeight <= chainActive.Height()-nCheckDepth)
             break;
         if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
+        if (pindex->nStatus & BLOCK_ASSUMED_VALID && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // Blocks before a loaded UTXO set snapshot were never downloaded.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (assumed valid, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -4102,16 +5001,16 @@ bool CChainState::ReplayBlocks(const CChainParams& params, CCoinsView* view)
     const CBlockIndex* pindexNew;            // New tip during the interrupted flush.
     const CBlockIndex* pindexFork = nullptr; // Latest block common to both the old and the new tip.
 
-    if (mapBlockIndex.count(hashHeads[0]) == 0) {
+    pindexNew = LookupBlockIndex(hashHeads[0]);
+    if (!pindexNew) {
         return error("ReplayBlocks(): reorganization to unknown block requested");
     }
-    pindexNew = mapBlockIndex[hashHeads[0]];
 
     if (!hashHeads[1].IsNull()) { // The old tip is allowed to be 0, indicating it's the first flush.
-        if (mapBlockIndex.count(hashHeads[1]) == 0) {
+        pindexOld = LookupBlockIndex(hashHeads[1]);
+        if (!pindexOld) {
             return error("ReplayBlocks(): reorganization from unknown block requested");
         }
-        pindexOld = mapBlockIndex[hashHeads[1]];
         pindexFork = LastCommonAncestor(pindexOld, pindexNew);
         assert(pindexFork != nullptr);
     }
@@ -4265,6 +5164,8 @@ bool RewindBlockIndex(const CChainParams& params) {
 }
 
 void CChainState::UnloadBlockIndex() {
+    // The block being read ahead is for an entry that is gone now.
+    m_block_read_ahead.Take(nullptr);
     nBlockSequenceId = 1;
     m_failed_blocks.clear();
     setBlockIndexCandidates.clear();
@@ -4283,6 +5184,8 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    g_mapped_block_files.Clear();
+    g_block_cache.Clear();
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
@@ -4290,9 +5193,6 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
     fHavePruned = false;
 
@@ -4351,24 +5251,29 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
-{
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
 
-    int nLoaded = 0;
+/**
+ * Find the blocks in a file in the format of the block files, and pass each
+ * to fn along with its position in the file. Stops early if fn returns false.
+ * Errors reading a block are logged, and fn is not called for it.
+ */
+static void ScanBlockFile(const CChainParams& chainparams, FILE* fileIn, const std::function<bool(const std::shared_ptr<CBlock>&, unsigned int)>& fn)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
+            if (ShutdownRequested()) break;
 
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            bool fCompressed = false;
             try {
                 // locate a header
                 unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
@@ -4379,6 +5284,8 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     continue;
                 // read size
                 blkdat >> nSize;
+                fCompressed = nSize & BLOCKFILE_COMPRESSED_FLAG;
+                nSize &= ~BLOCKFILE_COMPRESSED_FLAG;
                 if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
                     continue;
             } catch (const std::exception&) {
@@ -4388,78 +5295,21 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
-
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                      CValidationState state;
-                      if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
-                          nLoaded++;
-                      }
-                      if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
-                    }
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
+                if (fCompressed) {
+                    std::vector<unsigned char> compressed(nSize);
+                    blkdat.read((char*)compressed.data(), nSize);
+                    SpanReader(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(compressed.data(), compressed.size()), 0) >> CBlockCompressor(block);
+                } else {
+                    blkdat >> block;
                 }
+                nRewind = blkdat.GetPos();
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
+                if (!fn(pblock, nBlockPos)) {
+                    break;
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
@@ -4468,11 +5318,265 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+}
+
+/**
+ * Add a block read from a block file at dbp (or from an external file, if
+ * dbp is null) to the block index, along with the blocks found earlier that
+ * build on it. Returns false on errors that should stop the loading.
+ */
+static bool LoadBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* dbp, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+    uint256 hash = block.GetHash();
+    {
+        LOCK(cs_main);
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
+            LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+          CValidationState state;
+          if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+              nLoaded++;
+          }
+          if (state.IsError()) {
+              return false;
+          }
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+          LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
+        }
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    ScanBlockFile(chainparams, fileIn, [&](const std::shared_ptr<CBlock>& pblock, unsigned int nBlockPos) {
+        if (dbp)
+            dbp->nPos = nBlockPos;
+        return LoadBlock(chainparams, pblock, dbp, nLoaded);
+    });
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+namespace {
+
+/**
+ * The blocks read from the block files by -reindex, waiting to be added to the
+ * block index in file order. Each file is read by a thread of its own. The
+ * blocks waiting are limited in total (serialized) size, except that the file
+ * being added can always have one block waiting, so that it never waits for
+ * the files after it.
+ */
+class ReindexQueue
+{
+private:
+    struct QueuedBlock {
+        std::shared_ptr<CBlock> block;
+        unsigned int pos;
+        size_t size;
+    };
+    struct File {
+        std::deque<QueuedBlock> blocks;
+        bool done = false;
+        bool opened = true;
+        bool discarded = false;
+    };
+
+    CWaitableCriticalSection m_mutex;
+    CConditionVariable m_cond;
+    std::vector<File> m_files;
+    //! The file whose blocks are being added
+    int m_current = 0;
+    size_t m_queued_bytes = 0;
+    const size_t m_max_queued_bytes;
+    bool m_abort = false;
+
+public:
+    ReindexQueue(int files, size_t max_queued_bytes) : m_files(files), m_max_queued_bytes(max_queued_bytes) {}
+
+    /** Queue a block read from a file, once there is room. Returns false if reindexing stopped. */
+    bool Push(int file, const std::shared_ptr<CBlock>& block, unsigned int pos, size_t size)
+    {
+        WaitableLock lock(m_mutex);
+        m_cond.wait(lock, [&] {
+            return m_abort || m_files[file].discarded || m_queued_bytes + size <= m_max_queued_bytes || (file == m_current && m_files[file].blocks.empty());
+        });
+        if (m_abort || m_files[file].discarded) return false;
+        m_files[file].blocks.push_back(QueuedBlock{block, pos, size});
+        m_queued_bytes += size;
+        m_cond.notify_all();
+        return true;
+    }
+
+    /** Mark a file as completely read, or as one that could not be opened. */
+    void Done(int file, bool opened)
+    {
+        WaitableLock lock(m_mutex);
+        m_files[file].done = true;
+        m_files[file].opened = opened;
+        m_cond.notify_all();
+    }
+
+    /** Wait for the next block of a file. Returns false once all of them were taken. */
+    bool Pop(int file, std::shared_ptr<CBlock>& block, unsigned int& pos)
+    {
+        WaitableLock lock(m_mutex);
+        if (m_current != file) {
+            m_current = file;
+            m_cond.notify_all();
+        }
+        File& queued = m_files[file];
+        m_cond.wait(lock, [&] { return !queued.blocks.empty() || queued.done; });
+        if (queued.blocks.empty()) return false;
+        block = std::move(queued.blocks.front().block);
+        pos = queued.blocks.front().pos;
+        m_queued_bytes -= queued.blocks.front().size;
+        queued.blocks.pop_front();
+        m_cond.notify_all();
+        return true;
+    }
+
+    /** Drop the blocks of a file that are still waiting, and stop its reader. Returns whether it was opened. */
+    bool Discard(int file)
+    {
+        WaitableLock lock(m_mutex);
+        File& queued = m_files[file];
+        queued.discarded = true;
+        for (const QueuedBlock& entry : queued.blocks) {
+            m_queued_bytes -= entry.size;
+        }
+        queued.blocks.clear();
+        m_cond.notify_all();
+        m_cond.wait(lock, [&] { return queued.done; });
+        return queued.opened;
+    }
+
+    /** Make the readers stop. */
+    void Abort()
+    {
+        WaitableLock lock(m_mutex);
+        m_abort = true;
+        m_cond.notify_all();
+    }
+};
+
+} // namespace
+
+void ReindexBlockFiles(const CChainParams& chainparams)
+{
+    int nFiles = 0;
+    while (fs::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk"))) {
+        nFiles++;
+    }
+
+    const size_t nMaxQueued = std::max<int64_t>(1, gArgs.GetArg("-reindexbuffer", DEFAULT_REINDEX_BUFFER)) << 20;
+    ReindexQueue queue(nFiles, nMaxQueued);
+    auto scan = [&chainparams, &queue](int nFile) {
+        FILE* file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+        if (!file) {
+            queue.Done(nFile, false); // This error is logged in OpenBlockFile
+            return;
+        }
+        ScanBlockFile(chainparams, file, [&](const std::shared_ptr<CBlock>& pblock, unsigned int nBlockPos) {
+            // Do the context-free checks here too. They cache their result in
+            // fChecked, so that AcceptBlock does not redo them under cs_main.
+            CValidationState state;
+            CheckBlock(*pblock, state, chainparams.GetConsensus());
+            return queue.Push(nFile, pblock, nBlockPos, ::GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION));
+        });
+        queue.Done(nFile, true);
+    };
+
+    // Read the next files while adding the blocks of the current one.
+    const size_t nScanAhead = std::max(1, std::min(nScriptCheckThreads, MAX_REINDEX_SCAN_THREADS));
+    std::deque<std::future<void>> scans;
+    try {
+        int nNextFile = 0;
+        for (int nFile = 0; nFile < nFiles; nFile++) {
+            while (nNextFile < nFiles && scans.size() < nScanAhead) {
+                scans.push_back(std::async(std::launch::async, scan, nNextFile++));
+            }
+
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            int64_t nStart = GetTimeMillis();
+            int nLoaded = 0;
+            std::shared_ptr<CBlock> pblock;
+            unsigned int nBlockPos;
+            while (queue.Pop(nFile, pblock, nBlockPos)) {
+                boost::this_thread::interruption_point();
+                CDiskBlockPos pos(nFile, nBlockPos);
+                try {
+                    if (!LoadBlock(chainparams, pblock, &pos, nLoaded)) break;
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
+            }
+            if (nLoaded > 0)
+                LogPrintf("Reindexed %i blocks from blk%05u.dat in %dms\n", nLoaded, (unsigned int)nFile, GetTimeMillis() - nStart);
+            const bool opened = queue.Discard(nFile);
+            scans.front().get();
+            scans.pop_front();
+            if (!opened) break;
+        }
+    } catch (...) {
+        queue.Abort();
+        throw;
+    }
+    queue.Abort();
+}
+
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4491,7 +5595,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
-    for (auto& entry : mapBlockIndex) {
+    for (const auto& entry : mapBlockIndex) {
         forward.insert(std::make_pair(entry.second->pprev, entry.second));
     }
 
@@ -4517,7 +5621,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstMissing == nullptr && !(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_ASSUMED_VALID))) pindexFirstMissing = pindex;
         if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTreeValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
@@ -4534,8 +5638,9 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
         if (!fHavePruned) {
-            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
-            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0,
+            // except for blocks assumed valid from a UTXO set snapshot.
+            if (!(pindex->nStatus & BLOCK_ASSUMED_VALID)) assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
         } else {
             // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
@@ -4816,6 +5921,76 @@ bool DumpMempool(void)
     return true;
 }
 
+bool DumpBlockIndex()
+{
+    int64_t start = GetTimeMicros();
+
+    LOCK(cs_main);
+    if (!setDirtyBlockIndex.empty()) {
+        LogPrintf("Failed to dump block index: not all of it was written to the database\n");
+        return false;
+    }
+
+    // Sort by height, so that entries only refer to earlier ones.
+    std::vector<std::pair<int, const CBlockIndex*>> vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const auto& item : mapBlockIndex) {
+        vSortedByHeight.push_back(std::make_pair(item.second->nHeight, item.second));
+    }
+    std::sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    std::unordered_map<const CBlockIndex*, uint64_t> mapPosition;
+    mapPosition.reserve(vSortedByHeight.size());
+    for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+        mapPosition.emplace(vSortedByHeight[i].second, i + 1);
+    }
+    auto position = [&mapPosition](const CBlockIndex* pindex) -> uint64_t {
+        return pindex ? mapPosition.at(pindex) : 0;
+    };
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "blockindex.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        const uint64_t tag = GetRand(std::numeric_limits<uint64_t>::max());
+        file << BLOCK_INDEX_DUMP_VERSION << tag << (uint64_t)vSortedByHeight.size();
+        for (const std::pair<int, const CBlockIndex*>& item : vSortedByHeight) {
+            const CBlockIndex* pindex = item.second;
+            uint64_t prev = position(pindex->pprev), skip = position(pindex->pskip);
+            file << VARINT(prev) << VARINT(skip) << pindex->GetBlockHash();
+            file << VARINT(pindex->nHeight, VarIntMode::NONNEGATIVE_SIGNED);
+            file << VARINT(pindex->nStatus);
+            file << VARINT(pindex->nTx);
+            file << VARINT(pindex->nFile, VarIntMode::NONNEGATIVE_SIGNED);
+            file << VARINT(pindex->nDataPos);
+            file << VARINT(pindex->nUndoPos);
+            file << pindex->nVersion;
+            file << pindex->hashMerkleRoot;
+            file << pindex->nTime;
+            file << pindex->nBits;
+            file << pindex->nNonce;
+        }
+
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(GetDataDir() / "blockindex.dat.new", GetDataDir() / "blockindex.dat");
+        if (!pblocktree->WriteBlockIndexDumpTag(tag))
+            throw std::runtime_error("failed to write the dump tag");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped block index: %gs to sort, %gs to dump\n", (mid-start)*MICRO, (last-mid)*MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump block index: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -4835,15 +6010,3 @@ double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pin
     return pindex->nChainTx / fTxTotal;
 }
 
-class CMainCleanup
-{
-public:
-    CMainCleanup() {}
-    ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
-    }
-} instance_of_cmaincleanup;
@@ -11,6 +11,7 @@
 #endif
 
 #include <amount.h>
+#include <blockmap.h>
 #include <coins.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
@@ -21,6 +22,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <future>
 #include <map>
 #include <memory>
 #include <set>
@@ -31,8 +33,11 @@
 
 #include <atomic>
 
+class BlockCache;
+class CAutoFile;
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
@@ -41,6 +46,7 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+class PubKeyParseCache;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -70,6 +76,10 @@ static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** Maximum kilobytes for transactions to store for processing during reorg */
 static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
+/** The maximum number of blk?????.dat files mapped into memory for reading blocks */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 64;
+/** Flag in the size of a block in the blk?????.dat files, for blocks stored with CBlockCompressor */
+static const uint32_t BLOCKFILE_COMPRESSED_FLAG = 0x80000000;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -77,10 +87,20 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
-/** Maximum number of script-checking threads allowed */
+/** Maximum number of script-checking threads allowed, or the number of cores if higher */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -parsynced default (number of script-checking threads used once the initial block download is done) */
+static const int DEFAULT_SYNCED_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of block files read in parallel by -reindex */
+static const int MAX_REINDEX_SCAN_THREADS = 4;
+/** -reindexbuffer default (MiB of blocks read ahead by -reindex) */
+static const int64_t DEFAULT_REINDEX_BUFFER = 256;
+/** Default for -prefetchinputs */
+static const bool DEFAULT_PREFETCH_INPUTS = true;
+/** Default for -blockcompression */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -102,6 +122,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache limit kept in use (most recently used coins first) after a flush due to its size. */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 70;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Block download timeout base, expressed in millionths of the block interval (i.e. 10 min) */
@@ -117,9 +139,17 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_COINSTATSINDEX = false;
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_SPENTINDEX = false;
+static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
+/** Default for -persistblockindex */
+static const bool DEFAULT_PERSIST_BLOCK_INDEX = true;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -blockcache, the memory in megabytes kept for recently used blocks */
+static const int64_t DEFAULT_BLOCK_CACHE_SIZE = 32;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -132,21 +162,16 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
 
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
 
-struct BlockHasher
-{
-    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
-};
-
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
 extern std::atomic_bool g_is_mempool_loaded;
-typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap& mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockWeight;
@@ -157,11 +182,18 @@ extern uint256 g_best_block;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
+/** The number of script-checking (and input prefetch) threads to use once the initial block download is done, at most nScriptCheckThreads. */
+extern int nSyncedScriptCheckThreads;
+extern bool fPrefetchInputs;
+/** Whether new blocks are stored compressed in the block files. */
+extern bool fCompressBlocks;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Recently connected or read blocks. */
+extern BlockCache g_block_cache;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -179,9 +211,6 @@ extern arith_uint256 nMinimumChainWork;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
-/** Minimum disk space required - used in CheckDiskSpace() */
-static const uint64_t nMinDiskSpace = 52428800;
-
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
@@ -251,6 +280,8 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Rebuild the block index from the block files, for -reindex. Files are read in parallel, but their blocks added in order. */
+void ReindexBlockFiles(const CChainParams& chainparams);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -258,10 +289,33 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Update the chain tip based on database information. */
 bool LoadChainTip(const CChainParams& chainparams);
+/**
+ * Build the chainstate from a UTXO set snapshot written by dumptxoutset. The
+ * chainstate must be empty, and the snapshot must match the assumeutxo data of
+ * the chain parameters. The blocks up to the snapshot's base are marked
+ * BLOCK_ASSUMED_VALID, and the base becomes the tip.
+ */
+bool LoadTxOutSetSnapshot(CAutoFile& file, const CChainParams& chainparams, CValidationState& state);
+/** Whether the active chain has blocks assumed valid by a loaded UTXO set snapshot, which are yet to be validated. */
+bool IsSnapshotValidationPending();
+/**
+ * Validate the blocks assumed valid by a loaded UTXO set snapshot, connecting
+ * them from genesis on with coins of their own, and check the resulting UTXO
+ * set against the snapshot. The blocks are downloaded as background
+ * validation needs them. Returns when done, or throws when interrupted.
+ */
+void ThreadValidateSnapshot(size_t coins_db_cache, size_t coins_cache);
+/**
+ * The blocks background validation of a UTXO set snapshot needs next: those
+ * after from, up to and including target. Returns false if it isn't running.
+ */
+bool GetBackgroundValidationRange(const CBlockIndex*& from, const CBlockIndex*& target) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the block input prefetching thread */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -363,11 +417,12 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    const PubKeyParseCache* m_pubkey_cache;
 
 public:
-    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), m_pubkey_cache(nullptr) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, const PubKeyParseCache* pubkey_cache = nullptr) :
+        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), m_pubkey_cache(pubkey_cache) { }
 
     bool operator()();
 
@@ -379,6 +434,7 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(m_pubkey_cache, check.m_pubkey_cache);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -391,8 +447,47 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read a block, or get it from the block cache if it is there. Returns null on failure.
+ * With cache_block, a block read from disk is added to the cache. Only do that for blocks
+ * that are likely to be read again soon, like the ones served to peers, and not when
+ * scanning through history, which would evict the recent blocks.
+ */
+std::shared_ptr<const CBlock> ReadBlockFromDisk(const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool cache_block = false);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
+
+/**
+ * Reads the block expected to be connected next on a background thread, and
+ * runs the context-free CheckBlock() on it, so that disk I/O, deserialization
+ * and merkle root/sigop checks of that block overlap with connecting (mostly:
+ * verifying the scripts of) the current one.
+ *
+ * At most one read is in flight. A block that failed to be read or checked is
+ * simply not handed out (or handed out unchecked), leaving the regular code
+ * path to read it again and report the failure.
+ */
+class BlockReadAhead
+{
+private:
+    const CBlockIndex* m_pindex = nullptr;
+    std::future<std::shared_ptr<const CBlock>> m_block;
+
+    static std::shared_ptr<const CBlock> ReadAndCheck(const CDiskBlockPos pos, const uint256 hash, const Consensus::Params& params);
+
+public:
+    ~BlockReadAhead() { Take(nullptr); }
+
+    /** Start reading the block for pindex, unless it is already being read. */
+    void Start(const CBlockIndex* pindex, const Consensus::Params& params) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /**
+     * Return the block read for pindex, or nullptr if it is not available.
+     * Any other outstanding read is waited for and discarded.
+     */
+    std::shared_ptr<const CBlock> Take(const CBlockIndex* pindex);
+};
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -488,6 +583,12 @@ static const unsigned int REJECT_HIGHFEE = 0x100;
 /** Get block file info entry for one block file */
 CBlockFileInfo* GetBlockFileInfo(size_t n);
 
+/**
+ * Dump the block index to disk, to be loaded at the next start instead of
+ * reading it from the block tree database. It must have been flushed first.
+ */
+bool DumpBlockIndex();
+
 /** Dump the mempool to disk. */
 bool DumpMempool();
 
@@ -497,7 +598,7 @@ bool LoadMempool();
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
-    return (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0);
+    return ((fHavePruned || pblockindex->nStatus & BLOCK_ASSUMED_VALID) && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0);
 }
 
 #endif // BITCOIN_VALIDATION_H
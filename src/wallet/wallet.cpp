@@ -3364,6 +3364,9 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         }
         bool internal = false;
         WalletBatch batch(*database);
+        // The key IDs of the new keys are computed together at the end.
+        std::vector<int64_t> new_indexes;
+        std::vector<CPubKey> new_pubkeys;
         for (int64_t i = missingInternal + missingExternal; i--;)
         {
             if (i < missingInternal) {
@@ -3383,7 +3386,12 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
             } else {
                 setExternalKeyPool.insert(index);
             }
-            m_pool_key_to_index[pubkey.GetID()] = index;
+            new_indexes.push_back(index);
+            new_pubkeys.push_back(pubkey);
+        }
+        const std::vector<CKeyID> new_ids = GetKeyIDs(new_pubkeys);
+        for (size_t i = 0; i < new_ids.size(); ++i) {
+            m_pool_key_to_index[new_ids[i]] = new_indexes[i];
         }
         if (missingInternal + missingExternal > 0) {
             WalletLogPrintf("keypool added %d keys (%d internal), size=%u (%u internal)\n", missingInternal + missingExternal, missingInternal, setInternalKeyPool.size() + setExternalKeyPool.size() + set_pre_split_keypool.size(), setInternalKeyPool.size());
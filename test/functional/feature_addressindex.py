@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the address index and getaddresshistory.
+
+- The history of an address lists the outputs paying to it and the inputs
+  spending them, in block order, a page at a time.
+- Addresses and raw scripts can be looked up.
+- An index built by several threads from scratch matches.
+- The index survives restarts and follows reorgs.
+"""
+from decimal import Decimal
+
+from test_framework.authproxy import JSONRPCException
+from test_framework.messages import (
+    CTransaction,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import (
+    CScript,
+    OP_TRUE,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    sync_blocks,
+    wait_until,
+)
+
+class AddressIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-addressindex'], []]
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript('51')['p2sh']
+        other_address = node.decodescript('52')['p2sh']
+        blockhashes = node.generatetoaddress(110, address)
+
+        self.log.info("The history lists the coinbases paying to the address")
+        history = node.getaddresshistory(address, 1000)
+        assert 'next' not in history
+        entries = history['entries']
+        assert_equal(len(entries), 110)
+        for height, entry in enumerate(entries, 1):
+            assert_equal(entry['type'], 'output')
+            assert_equal(entry['height'], height)
+            assert_equal(entry['blockhash'], blockhashes[height - 1])
+            assert_equal(entry['txid'], node.getblock(blockhashes[height - 1])['tx'][0])
+            assert_equal(entry['n'], 0)
+            assert_equal(entry['amount'], 50)
+        assert_equal(node.getaddresshistory(other_address)['entries'], [])
+
+        self.log.info("The history can be read a page at a time")
+        paged = []
+        page = node.getaddresshistory(address, 25)
+        while True:
+            paged += page['entries']
+            if 'next' not in page:
+                break
+            assert_equal(len(page['entries']), 25)
+            page = node.getaddresshistory(address, 25, page['next'])
+        assert_equal(paged, entries)
+
+        self.log.info("Spend a coinbase to another address")
+        tx = FromHex(CTransaction(), node.createrawtransaction([{'txid': entries[0]['txid'], 'vout': 0}], {other_address: 49}))
+        tx.vin[0].scriptSig = CScript([CScript([OP_TRUE])])
+        txid = node.sendrawtransaction(ToHex(tx), True)
+        spend_block = node.generatetoaddress(1, address)[0]
+        spend = node.getaddresshistory(address, 1000)['entries'][-1]
+        assert_equal(spend, {'type': 'spend', 'txid': txid, 'n': 0, 'amount': 50, 'height': 111, 'blockhash': spend_block})
+        other_entries = node.getaddresshistory(other_address)['entries']
+        assert_equal(other_entries, [{'type': 'output', 'txid': txid, 'n': 0, 'amount': 49, 'height': 111, 'blockhash': spend_block}])
+        # A raw scriptPubKey works too.
+        other_script = node.validateaddress(other_address)['scriptPubKey']
+        assert_equal(node.getaddresshistory(other_script)['entries'], other_entries)
+
+        self.log.info("Check invalid arguments")
+        assert_raises_rpc_error(-5, 'Invalid address or script', node.getaddresshistory, 'foo')
+        assert_raises_rpc_error(-8, 'count must be between 1 and 1000', node.getaddresshistory, address, 0)
+        assert_raises_rpc_error(-8, 'count must be between 1 and 1000', node.getaddresshistory, address, 1001)
+        assert_raises_rpc_error(-8, 'Invalid start position', node.getaddresshistory, address, 10, '00')
+        assert_raises_rpc_error(-1, 'getaddresshistory requires -addressindex', self.nodes[1].getaddresshistory, address)
+
+        self.log.info("An index built by several threads matches")
+        sync_blocks(self.nodes)
+        self.restart_node(1, extra_args=['-addressindex', '-indexthreads=4'])
+        def synced():
+            try:
+                self.nodes[1].getaddresshistory(address)
+                return True
+            except JSONRPCException:
+                return False
+        wait_until(synced, timeout=30)
+        for addr in [address, other_address]:
+            assert_equal(self.nodes[1].getaddresshistory(addr, 1000), node.getaddresshistory(addr, 1000))
+
+        self.log.info("The index is kept across restarts")
+        self.restart_node(0, extra_args=['-addressindex'])
+        assert_equal(node.getaddresshistory(other_address)['entries'], other_entries)
+
+        self.log.info("The index follows a reorg")
+        node.invalidateblock(spend_block)
+        node.generatetoaddress(3, other_address)
+        other_entries = node.getaddresshistory(other_address)['entries']
+        assert_equal(len(other_entries), 4)
+        # The spend went back to the mempool and was mined again.
+        assert_equal(other_entries[1]['txid'], txid)
+        assert_equal(other_entries[1]['amount'], Decimal(49))
+        assert spend_block not in [entry['blockhash'] for entry in other_entries]
+        assert_equal(len(node.getaddresshistory(address, 1000)['entries']), 111)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
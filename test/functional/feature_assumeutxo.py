@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and starting a node from a UTXO set snapshot with -loadtxoutset.
+
+- Node 0 mines a deterministic chain up to the height of the regtest assumeutxo
+  data and dumps its UTXO set.
+- Snapshots at other heights, or that don't match the assumeutxo data, are refused.
+- Node 1 starts from the snapshot, without the blocks before it, and then
+  follows the chain from there.
+- Meanwhile node 1 downloads and validates the blocks before the snapshot in
+  the background, and checks them against it.
+"""
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.test_node import ErrorMatch
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    sync_blocks,
+    wait_until,
+)
+
+SNAPSHOT_BASE_HEIGHT = 110
+
+class AssumeutxoTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.add_nodes(self.num_nodes)
+        self.start_node(0)
+
+    def run_test(self):
+        n0 = self.nodes[0]
+        n1 = self.nodes[1]
+
+        # The regtest assumeutxo data commits to this exact chain.
+        n0.setmocktime(1500000000)
+        address = n0.decodescript('51')['p2sh']
+        n0.generatetoaddress(SNAPSHOT_BASE_HEIGHT, address)
+
+        self.log.info("Dump the UTXO set")
+        dump = n0.dumptxoutset('utxo.dat')
+        assert_equal(dump['base_height'], SNAPSHOT_BASE_HEIGHT)
+        assert_equal(dump['base_hash'], n0.getbestblockhash())
+        assert_equal(dump['coins_written'], SNAPSHOT_BASE_HEIGHT)
+        assert_equal(dump['path'], os.path.join(n0.datadir, 'regtest', 'utxo.dat'))
+        assert_equal(dump['hash_serialized_2'], n0.gettxoutsetinfo()['hash_serialized_2'])
+        assert_raises_rpc_error(-8, 'already exists', n0.dumptxoutset, 'utxo.dat')
+
+        n0.generatetoaddress(1, address)
+        dump_other = n0.dumptxoutset('utxo_other.dat')
+        n0.setmocktime(0)
+
+        self.log.info("Refuse snapshots that don't match the assumeutxo data")
+        n1.assert_start_raises_init_error(['-loadtxoutset=' + dump_other['path']], 'No assumeutxo data for UTXO set snapshot height 111', match=ErrorMatch.PARTIAL_REGEX)
+        bad_path = os.path.join(n0.datadir, 'utxo_bad.dat')
+        shutil.copyfile(dump['path'], bad_path)
+        with open(bad_path, 'r+b') as f:
+            f.seek(-1, os.SEEK_END)
+            last = f.read(1)
+            f.seek(-1, os.SEEK_END)
+            f.write(bytes([last[0] ^ 1]))
+        n1.assert_start_raises_init_error(['-loadtxoutset=' + bad_path], 'does not match the expected', match=ErrorMatch.PARTIAL_REGEX)
+        n1.assert_start_raises_init_error(['-loadtxoutset=' + dump['path'], '-reindex'], '-loadtxoutset is incompatible with -reindex', match=ErrorMatch.PARTIAL_REGEX)
+        n1.assert_start_raises_init_error(['-loadtxoutset=' + dump['path'], '-prune=550'], '-loadtxoutset is incompatible with -prune', match=ErrorMatch.PARTIAL_REGEX)
+
+        self.log.info("Start a node from the snapshot")
+        self.start_node(1, extra_args=['-loadtxoutset=' + dump['path']])
+        assert_equal(n1.getblockcount(), SNAPSHOT_BASE_HEIGHT)
+        assert_equal(n1.getbestblockhash(), dump['base_hash'])
+        assert_equal(n1.gettxoutsetinfo()['hash_serialized_2'], dump['hash_serialized_2'])
+        assert_raises_rpc_error(-1, 'Block not available', n1.getblock, n1.getblockhash(SNAPSHOT_BASE_HEIGHT // 2))
+
+        self.log.info("The snapshot is not loaded again on restart")
+        self.restart_node(1, extra_args=['-loadtxoutset=' + dump['path']])
+        assert_equal(n1.getbestblockhash(), dump['base_hash'])
+        assert_equal(n1.gettxoutsetinfo()['hash_serialized_2'], dump['hash_serialized_2'])
+
+        self.log.info("Follow the chain on top of the snapshot")
+        connect_nodes(n1, 0)
+        sync_blocks(self.nodes)
+        n1.generatetoaddress(5, address)
+        sync_blocks(self.nodes)
+        assert_equal(n1.getblockcount(), SNAPSHOT_BASE_HEIGHT + 6)
+        assert_equal(n0.gettxoutsetinfo()['hash_serialized_2'], n1.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("Validate the blocks before the snapshot in the background")
+        debug_log = os.path.join(n1.datadir, 'regtest', 'debug.log')
+        def validated():
+            with open(debug_log, encoding='utf-8') as f:
+                return 'Background validation: validated the UTXO set snapshot at height %d' % SNAPSHOT_BASE_HEIGHT in f.read()
+        wait_until(validated, timeout=60)
+        n1.getblock(n1.getblockhash(SNAPSHOT_BASE_HEIGHT // 2))
+        assert not os.path.exists(os.path.join(n1.datadir, 'regtest', 'chainstate_background'))
+
+        self.restart_node(1)
+        assert_equal(n1.getblockcount(), SNAPSHOT_BASE_HEIGHT + 6)
+        n1.getblock(n1.getblockhash(SNAPSHOT_BASE_HEIGHT // 2))
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test storing blocks compressed with -blockcompression.
+
+- Blocks are stored compressed, and read back the same for RPC, peers and
+  the transaction index.
+- Compressed blocks are read without the option too, and survive -reindex.
+"""
+import os
+import struct
+
+from test_framework.messages import (
+    CTransaction,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import (
+    CScript,
+    OP_TRUE,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes,
+    sync_blocks,
+)
+
+BLOCKFILE_COMPRESSED_FLAG = 0x80000000
+MAGIC_BYTES = b'\xfa\xbf\xb5\xda'
+
+class BlockCompressionTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [['-blockcompression', '-txindex'], [], []]
+
+    def setup_network(self):
+        # Node 2 syncs from node 0 later, after its cache of recent blocks is gone.
+        self.setup_nodes()
+        connect_nodes(self.nodes[0], 1)
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript('51')['p2sh']
+        blockhashes = node.generatetoaddress(110, address)
+
+        self.log.info("Mine a block with a chain of spends")
+        txid = node.getblock(blockhashes[0])['tx'][0]
+        txids = []
+        for value in [49, 48]:
+            tx = FromHex(CTransaction(), node.createrawtransaction([{'txid': txid, 'vout': 0}], {address: value}))
+            tx.vin[0].scriptSig = CScript([CScript([OP_TRUE])])
+            txid = node.sendrawtransaction(ToHex(tx), True)
+            txids.append(txid)
+        blockhashes += node.generatetoaddress(1, address)
+        sync_blocks(self.nodes[0:2])
+        self.check_blocks(self.nodes[0:2], blockhashes)
+        for txid in txids:
+            assert_equal(node.getrawtransaction(txid, True)['blockhash'], blockhashes[-1])
+
+        self.log.info("Blocks are stored compressed")
+        records = self.read_block_records(0)
+        assert_equal(len(records), len(blockhashes) + 1)
+        assert all(size & BLOCKFILE_COMPRESSED_FLAG for size in records)
+        assert not any(size & BLOCKFILE_COMPRESSED_FLAG for size in self.read_block_records(1))
+
+        self.log.info("Serve compressed blocks from disk to a peer")
+        self.restart_node(0, extra_args=['-blockcompression', '-txindex'])
+        connect_nodes(self.nodes[2], 0)
+        sync_blocks([self.nodes[0], self.nodes[2]])
+        self.check_blocks(self.nodes, blockhashes)
+        for txid in txids:
+            assert_equal(node.getrawtransaction(txid, True)['blockhash'], blockhashes[-1])
+
+        self.log.info("Compressed blocks are read without -blockcompression, and after -reindex")
+        self.restart_node(0, extra_args=['-txindex', '-reindex'])
+        assert_equal(node.getbestblockhash(), blockhashes[-1])
+        self.check_blocks(self.nodes, blockhashes)
+        for txid in txids:
+            assert_equal(node.getrawtransaction(txid, True)['blockhash'], blockhashes[-1])
+        # New blocks are stored uncompressed again.
+        node.generatetoaddress(1, address)
+        records = self.read_block_records(0)
+        assert not records[-1] & BLOCKFILE_COMPRESSED_FLAG
+        assert all(size & BLOCKFILE_COMPRESSED_FLAG for size in records[:-1])
+
+    def check_blocks(self, nodes, blockhashes):
+        for blockhash in blockhashes:
+            block = nodes[0].getblock(blockhash, 0)
+            for other in nodes[1:]:
+                assert_equal(other.getblock(blockhash, 0), block)
+
+    def read_block_records(self, n):
+        """Return the sizes in the index headers of the blocks in blk00000.dat."""
+        sizes = []
+        with open(os.path.join(self.nodes[n].datadir, 'regtest', 'blocks', 'blk00000.dat'), 'rb') as f:
+            data = f.read()
+        # Like -reindex, skip over any space between the blocks.
+        pos = data.find(MAGIC_BYTES)
+        while pos != -1:
+            size = struct.unpack('<I', data[pos + 4:pos + 8])[0]
+            sizes.append(size)
+            pos = data.find(MAGIC_BYTES, pos + 8 + (size & ~BLOCKFILE_COMPRESSED_FLAG))
+        return sizes
+
+if __name__ == '__main__':
+    BlockCompressionTest().main()
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test loading the block index from the dump written at shutdown.
+
+- The block index is loaded from blockindex.dat after a clean shutdown,
+  including side chains and invalid blocks.
+- A dump is not used once the block tree database changed without it being
+  written again, or when it is damaged, or with -persistblockindex=0.
+"""
+import os
+import re
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+class BlockIndexDumpTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript('51')['p2sh']
+        blockhashes = node.generatetoaddress(120, address)
+
+        self.log.info("Add a side chain and an invalid block")
+        node.invalidateblock(blockhashes[110])
+        node.generatetoaddress(8, node.decodescript('52')['p2sh'])
+        node.reconsiderblock(blockhashes[110])
+        node.invalidateblock(blockhashes[115])
+
+        self.log.info("The block index is loaded from the dump after a restart")
+        # Compare with the block index loaded from the database, as some of
+        # the state (like the best header) is only recomputed when loading.
+        self.restart_node(0, extra_args=['-persistblockindex=0'])
+        assert_equal(self.get_load_source()[1], 'database')
+        state = self.get_state()
+        self.restart_node(0)
+        assert_equal(self.get_load_source()[1], 'database')
+        self.restart_node(0)
+        assert_equal(self.get_load_source(), (len(state['headers']), 'dump'))
+        assert_equal(self.get_state(), state)
+
+        self.log.info("A dump is not used after the database changed")
+        self.restart_node(0, extra_args=['-persistblockindex=0'])
+        assert_equal(self.get_load_source()[1], 'database')
+        node.reconsiderblock(blockhashes[115])
+        node.generatetoaddress(2, address)
+        state = self.get_state()
+        self.restart_node(0)
+        assert_equal(self.get_load_source(), (len(state['headers']), 'database'))
+        assert_equal(self.get_state(), state)
+
+        self.log.info("A damaged dump is not used")
+        self.stop_node(0)
+        dump_path = os.path.join(node.datadir, 'regtest', 'blockindex.dat')
+        with open(dump_path, 'r+b') as f:
+            f.truncate(os.path.getsize(dump_path) // 2)
+        self.start_node(0)
+        assert_equal(self.get_load_source()[1], 'database')
+        assert_equal(self.get_state(), state)
+        self.restart_node(0)
+        assert_equal(self.get_load_source()[1], 'dump')
+        node.generatetoaddress(1, address)
+        assert_equal(node.getblockcount(), len(blockhashes) + 3)
+
+    def get_state(self):
+        node = self.nodes[0]
+        tips = node.getchaintips()
+        headers = {}
+        for tip in tips:
+            blockhash = tip['hash']
+            while blockhash is not None and blockhash not in headers:
+                headers[blockhash] = node.getblockheader(blockhash)
+                headers[blockhash].pop('confirmations')
+                blockhash = headers[blockhash].get('previousblockhash')
+        return {'tips': sorted(tips, key=lambda tip: tip['hash']), 'headers': headers, 'info': node.getblockchaininfo()}
+
+    def get_load_source(self):
+        """Return the number of block index entries loaded at the last start, and where from."""
+        with open(os.path.join(self.nodes[0].datadir, 'regtest', 'debug.log'), encoding='utf-8') as f:
+            matches = re.findall(r'loaded (\d+) block index entries from the (\w+)', f.read())
+        return int(matches[-1][0]), matches[-1][1]
+
+if __name__ == '__main__':
+    BlockIndexDumpTest().main()
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the coinstats index and gettxoutsetinfo with it.
+
+- Node 0 runs with -coinstatsindex, node 1 without; both report the same
+  statistics and MuHash of the UTXO set.
+- The index answers for any height of the active chain.
+- The index survives restarts and follows reorgs.
+"""
+from decimal import Decimal
+
+from test_framework.authproxy import JSONRPCException
+from test_framework.messages import (
+    COIN,
+    CTransaction,
+    CTxOut,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import (
+    CScript,
+    OP_RETURN,
+    OP_TRUE,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    sync_blocks,
+    wait_until,
+)
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-coinstatsindex'], []]
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript('51')['p2sh']
+        blockhashes = node.generatetoaddress(110, address)
+        sync_blocks(self.nodes)
+        self.sync_index()
+
+        self.log.info("The index reports the same statistics as the chainstate")
+        self.check_stats()
+        index_stats = node.gettxoutsetinfo('muhash')
+        assert 'transactions' not in index_stats
+        assert 'disk_size' not in index_stats
+        assert 'hash_serialized_2' not in index_stats
+        assert_equal(index_stats['txouts'], 110)
+        assert_equal(index_stats['total_amount'], 110 * 50)
+        # With the index, the default hash is the one the index provides.
+        assert_equal(node.gettxoutsetinfo(), index_stats)
+        assert 'muhash' not in self.nodes[1].gettxoutsetinfo()
+        # The legacy hash is still computed from the chainstate.
+        assert_equal(node.gettxoutsetinfo('hash_serialized_2')['hash_serialized_2'], self.nodes[1].gettxoutsetinfo()['hash_serialized_2'])
+        assert 'muhash' not in node.gettxoutsetinfo(None, None, False)
+        assert 'hash_serialized_2' not in node.gettxoutsetinfo('none')
+        assert 'muhash' not in node.gettxoutsetinfo('none', None, True)
+
+        self.log.info("Spend a coinbase, with an unspendable output")
+        tx = FromHex(CTransaction(), node.createrawtransaction([{'txid': node.getblock(blockhashes[0])['tx'][0], 'vout': 0}], {address: 49}))
+        tx.vin[0].scriptSig = CScript([CScript([OP_TRUE])])
+        tx.vout.append(CTxOut(1 * COIN - 10000, CScript([OP_RETURN])))
+        node.sendrawtransaction(ToHex(tx))
+        node.generatetoaddress(1, address)
+        sync_blocks(self.nodes)
+        self.sync_index()
+        self.check_stats()
+        stats = node.gettxoutsetinfo('muhash')
+        assert_equal(stats['txouts'], 111)
+        assert_equal(stats['total_amount'], 111 * 50 - 1 + Decimal('0.0001'))
+
+        self.log.info("Look up statistics at a past height")
+        past = node.gettxoutsetinfo('muhash', 50)
+        assert_equal(past['height'], 50)
+        assert_equal(past['bestblock'], blockhashes[49])
+        assert_equal(past['txouts'], 50)
+        assert_equal(node.gettxoutsetinfo('muhash', blockhashes[49]), past)
+        assert_equal(node.gettxoutsetinfo('none', 0)['txouts'], 0)
+        assert_raises_rpc_error(-8, 'Target block height 1000 out of range', node.gettxoutsetinfo, 'muhash', 1000)
+        assert_raises_rpc_error(-8, 'requires coinstatsindex', self.nodes[1].gettxoutsetinfo, 'muhash', 50)
+        assert_raises_rpc_error(-8, 'requires coinstatsindex', node.gettxoutsetinfo, 'hash_serialized_2', 50)
+        assert_raises_rpc_error(-8, 'foo is not a valid hash_type', node.gettxoutsetinfo, 'foo')
+
+        self.log.info("The index is kept across restarts")
+        self.restart_node(0, extra_args=['-coinstatsindex'])
+        connect_nodes(node, 1)
+        self.sync_index()
+        assert_equal(node.gettxoutsetinfo('muhash', 50), past)
+        node.generatetoaddress(1, address)
+        sync_blocks(self.nodes)
+        self.sync_index()
+        self.check_stats()
+
+        self.log.info("The index follows a reorg")
+        tip_height = node.getblockcount()
+        node.invalidateblock(node.getblockhash(tip_height - 1))
+        # Mine to another address, so the blocks differ from the invalidated ones.
+        node.generatetoaddress(3, node.decodescript('52')['p2sh'])
+        self.sync_index()
+        assert_equal(node.getblockcount(), tip_height + 1)
+        sync_blocks(self.nodes)
+        self.check_stats()
+        # The coinbase spend went back to the mempool and was mined again.
+        assert_equal(node.gettxoutsetinfo('muhash')['txouts'], tip_height + 1)
+
+    def sync_index(self):
+        node = self.nodes[0]
+        def synced():
+            try:
+                node.gettxoutsetinfo('none', node.getblockcount())
+                return True
+            except JSONRPCException:
+                return False
+        wait_until(synced, timeout=30)
+
+    def check_stats(self):
+        index_stats = self.nodes[0].gettxoutsetinfo('muhash')
+        chainstate_stats = self.nodes[0].gettxoutsetinfo('muhash', None, False)
+        other_stats = self.nodes[1].gettxoutsetinfo('muhash')
+        for key in ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']:
+            assert_equal(index_stats[key], chainstate_stats[key])
+            assert_equal(index_stats[key], other_stats[key])
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
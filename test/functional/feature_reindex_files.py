@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -reindex with blocks spread over several block files.
+
+The files are read in parallel, and their blocks added in order. Here the
+blocks of the chain are split over three files out of order, so that most
+blocks are found before their parents.
+"""
+import os
+import struct
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    wait_until,
+)
+
+MAGIC_BYTES = b'\xfa\xbf\xb5\xda'
+
+class ReindexFilesTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        blockhashes = node.generatetoaddress(150, node.decodescript('51')['p2sh'])
+        blocks = [node.getblock(blockhash, 0) for blockhash in blockhashes]
+        self.stop_node(0)
+
+        self.log.info("Split the blocks over three files, the latest ones first")
+        blocks_dir = os.path.join(node.datadir, 'regtest', 'blocks')
+        records = self.read_block_records(os.path.join(blocks_dir, 'blk00000.dat'))
+        assert_equal(len(records), len(blockhashes) + 1)
+        for name in os.listdir(blocks_dir):
+            if name.startswith('rev'):
+                os.remove(os.path.join(blocks_dir, name))
+        for n, part in enumerate([records[101:], records[:51], records[51:101]]):
+            with open(os.path.join(blocks_dir, 'blk%05d.dat' % n), 'wb') as f:
+                f.write(b''.join(part))
+
+        self.log.info("Reindex")
+        self.start_node(0, extra_args=['-reindex'])
+        wait_until(lambda: node.getblockcount() == len(blockhashes))
+        assert_equal(node.getbestblockhash(), blockhashes[-1])
+        for blockhash, block in zip(blockhashes, blocks):
+            assert_equal(node.getblock(blockhash, 0), block)
+
+        self.log.info("The chain is kept across restarts")
+        self.restart_node(0)
+        assert_equal(node.getbestblockhash(), blockhashes[-1])
+        node.generatetoaddress(1, node.decodescript('51')['p2sh'])
+        assert_equal(node.getblockcount(), len(blockhashes) + 1)
+
+    def read_block_records(self, path):
+        """Return the blocks in a block file, with their index headers."""
+        with open(path, 'rb') as f:
+            data = f.read()
+        records = []
+        pos = 0
+        while data[pos:pos + 4] == MAGIC_BYTES:
+            size = struct.unpack('<I', data[pos + 4:pos + 8])[0]
+            records.append(data[pos:pos + 8 + size])
+            pos += 8 + size
+        return records
+
+if __name__ == '__main__':
+    ReindexFilesTest().main()
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the spent-output index and getspentinfo.
+
+- getspentinfo returns the input spending an output of the active chain.
+- The index survives restarts and follows reorgs.
+"""
+from test_framework.messages import (
+    CTransaction,
+    FromHex,
+    ToHex,
+)
+from test_framework.script import (
+    CScript,
+    OP_TRUE,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+)
+
+class SpentIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-spentindex'], []]
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript('51')['p2sh']
+        blockhashes = node.generatetoaddress(110, address)
+        coinbase = node.getblock(blockhashes[0])['tx'][0]
+        assert_raises_rpc_error(-5, 'No spending transaction found', node.getspentinfo, coinbase, 0)
+
+        self.log.info("Spend a coinbase")
+        tx = FromHex(CTransaction(), node.createrawtransaction([{'txid': coinbase, 'vout': 0}], {address: 49}))
+        tx.vin[0].scriptSig = CScript([CScript([OP_TRUE])])
+        txid = node.sendrawtransaction(ToHex(tx), True)
+        # Unconfirmed spends are not indexed.
+        assert_raises_rpc_error(-5, 'No spending transaction found', node.getspentinfo, coinbase, 0)
+        spend_block = node.generatetoaddress(1, address)[0]
+        info = {'txid': txid, 'vin': 0, 'amount': 50, 'height': 111, 'blockhash': spend_block}
+        assert_equal(node.getspentinfo(coinbase, 0), info)
+        assert_raises_rpc_error(-5, 'No spending transaction found', node.getspentinfo, txid, 0)
+
+        self.log.info("Check invalid arguments")
+        assert_raises_rpc_error(-8, 'Invalid output index', node.getspentinfo, coinbase, -1)
+        assert_raises_rpc_error(-8, 'txid must be hexadecimal string', node.getspentinfo, 'foo', 0)
+        assert_raises_rpc_error(-1, 'getspentinfo requires -spentindex', self.nodes[1].getspentinfo, coinbase, 0)
+
+        self.log.info("The index is kept across restarts")
+        self.restart_node(0, extra_args=['-spentindex'])
+        assert_equal(node.getspentinfo(coinbase, 0), info)
+
+        self.log.info("The index follows a reorg")
+        node.invalidateblock(spend_block)
+        assert_raises_rpc_error(-5, 'No spending transaction found', node.getspentinfo, coinbase, 0)
+        # The spend went back to the mempool and is mined again.
+        new_block = node.generatetoaddress(1, node.decodescript('52')['p2sh'])[0]
+        info['blockhash'] = new_block
+        assert_equal(node.getspentinfo(coinbase, 0), info)
+
+if __name__ == '__main__':
+    SpentIndexTest().main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the getblockfilter RPC."""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_is_hex_string,
+    assert_raises_rpc_error,
+    connect_nodes,
+    disconnect_nodes,
+    sync_blocks,
+    wait_until,
+)
+
+FILTER_TYPES = ["basic"]
+
+class GetBlockFilterTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-blockfilterindex"], []]
+
+    def run_test(self):
+        # Create two chains by disconnecting nodes 0 & 1, mining, then reconnecting
+        disconnect_nodes(self.nodes[0], 1)
+
+        self.nodes[0].generatetoaddress(3, self.nodes[0].decodescript('51')['p2sh'])
+        self.nodes[1].generatetoaddress(4, self.nodes[1].decodescript('52')['p2sh'])
+
+        assert_equal(self.nodes[0].getblockcount(), 3)
+        chain0_hashes = [self.nodes[0].getblockhash(block_height) for block_height in range(4)]
+
+        # Reorg node 0 to a new chain
+        connect_nodes(self.nodes[0], 1)
+        sync_blocks(self.nodes)
+
+        assert_equal(self.nodes[0].getblockcount(), 4)
+        chain1_hashes = [self.nodes[0].getblockhash(block_height) for block_height in range(4)]
+
+        # Test getblockfilter returns a filter for all blocks and filter types on active chain
+        for block_hash in chain1_hashes:
+            for filter_type in FILTER_TYPES:
+                result = self.getblockfilter_synced(block_hash, filter_type)
+                assert_is_hex_string(result['filter'])
+                assert_is_hex_string(result['header'])
+
+        # Test getblockfilter returns a filter for all blocks and filter types on stale chain
+        for block_hash in chain0_hashes:
+            for filter_type in FILTER_TYPES:
+                result = self.nodes[0].getblockfilter(block_hash, filter_type)
+                assert_is_hex_string(result['filter'])
+                assert_is_hex_string(result['header'])
+
+        # The genesis block is shared, the chains diverge after it
+        assert_equal(self.nodes[0].getblockfilter(chain0_hashes[0]), self.nodes[0].getblockfilter(chain1_hashes[0]))
+        assert self.nodes[0].getblockfilter(chain0_hashes[1])['header'] != self.nodes[0].getblockfilter(chain1_hashes[1])['header']
+
+        # The index is kept across restarts
+        filters = [self.nodes[0].getblockfilter(block_hash) for block_hash in chain0_hashes + chain1_hashes]
+        self.restart_node(0, extra_args=["-blockfilterindex=basic"])
+        assert_equal([self.getblockfilter_synced(block_hash, "basic") for block_hash in chain0_hashes + chain1_hashes], filters)
+
+        # Test getblockfilter with unknown block
+        bad_block_hash = "0123456789abcdef" * 4
+        assert_raises_rpc_error(-5, "Block not found", self.nodes[0].getblockfilter, bad_block_hash, "basic")
+
+        # Test getblockfilter with undefined filter type
+        genesis_hash = self.nodes[0].getblockhash(0)
+        assert_raises_rpc_error(-5, "Unknown filtertype", self.nodes[0].getblockfilter, genesis_hash, "unknown")
+
+        # Test getblockfilter on a node without the index
+        assert_raises_rpc_error(-1, "Index is not enabled for filtertype basic", self.nodes[1].getblockfilter, genesis_hash)
+
+    def getblockfilter_synced(self, block_hash, filter_type):
+        """Wait for the index to catch up with the block, then return its filter."""
+        result = []
+        def synced():
+            try:
+                result.append(self.nodes[0].getblockfilter(block_hash, filter_type))
+                return True
+            except Exception:
+                return False
+        wait_until(synced, timeout=30)
+        return result[-1]
+
+if __name__ == '__main__':
+    GetBlockFilterTest().main()
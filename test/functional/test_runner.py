@@ -83,6 +83,13 @@ BASE_SCRIPTS = [
     'rpc_rawtransaction.py',
     'wallet_address_types.py',
     'feature_reindex.py',
+    'feature_assumeutxo.py',
+    'feature_coinstatsindex.py',
+    'feature_addressindex.py',
+    'feature_spentindex.py',
+    'feature_blockcompression.py',
+    'feature_reindex_files.py',
+    'feature_blockindex_dump.py',
     # vv Tests less than 30s vv
     'wallet_keypool_topup.py',
     'interface_zmq.py',
@@ -143,6 +150,8 @@ BASE_SCRIPTS = [
     'wallet_fallbackfee.py',
     'feature_minchainwork.py',
     'rpc_getblockstats.py',
+    'rpc_getblockfilter.py',
+    'p2p_blockfilters.py',
     'p2p_fingerprint.py',
     'feature_uacomment.py',
     'p2p_unrequested_blocks.py',